@@ -0,0 +1,568 @@
+// Load generator for the broadcast server: N publishers send [VIDEO_STATUS]
+// updates at a fixed rate on one channel, M subscribers receive them, and the
+// report covers end-to-end latency, throughput and the server's CPU and
+// memory cost. All clients run on two threads so the bench itself stays cheap
+// next to the server.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "frame.h"
+#include "status_record.h"
+
+namespace {
+constexpr std::string_view kTimestampField = " bench_ns=";
+constexpr int kMaxEvents = 256;
+constexpr int kReceiveBufferSize = 64 * 1024;
+constexpr auto kServerStartTimeout = std::chrono::seconds(3);
+constexpr auto kSettleTime = std::chrono::milliseconds(300);
+
+struct Options {
+  std::string host = "127.0.0.1";
+  int port = 54100;
+  std::string server_path;
+  std::vector<std::string> server_args;
+  pid_t server_pid = 0;
+  int publishers = 4;
+  int subscribers = 64;
+  double rate = 30.0;
+  double duration_seconds = 10.0;
+  double warmup_seconds = 1.0;
+  std::string channel = "bench";
+  WireFormat format = WireFormat::kText;
+};
+
+struct Subscriber {
+  int fd = -1;
+  std::string inbound;
+};
+
+struct ProcessSample {
+  double cpu_seconds = 0.0;
+  uint64_t rss_kib = 0;
+};
+
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void print_usage(const char* program) {
+  std::cerr << "Usage: " << program
+            << " [--host IP] [--port N] [--server PATH [--server-arg ARG]...] [--pid PID]"
+               " [--publishers N] [--subscribers M] [--rate HZ] [--duration SECONDS]"
+               " [--warmup SECONDS] [--channel NAME] [--binary]\n";
+}
+
+bool parse_args(int argc, char* argv[], Options* options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--host" && has_value) {
+      options->host = argv[++i];
+    } else if (arg == "--port" && has_value) {
+      options->port = std::stoi(argv[++i]);
+    } else if (arg == "--server" && has_value) {
+      options->server_path = argv[++i];
+    } else if (arg == "--server-arg" && has_value) {
+      options->server_args.push_back(argv[++i]);
+    } else if (arg == "--pid" && has_value) {
+      options->server_pid = static_cast<pid_t>(std::stoi(argv[++i]));
+    } else if (arg == "--publishers" && has_value) {
+      options->publishers = std::stoi(argv[++i]);
+    } else if (arg == "--subscribers" && has_value) {
+      options->subscribers = std::stoi(argv[++i]);
+    } else if (arg == "--rate" && has_value) {
+      options->rate = std::stod(argv[++i]);
+    } else if (arg == "--duration" && has_value) {
+      options->duration_seconds = std::stod(argv[++i]);
+    } else if (arg == "--warmup" && has_value) {
+      options->warmup_seconds = std::stod(argv[++i]);
+    } else if (arg == "--channel" && has_value) {
+      options->channel = argv[++i];
+    } else if (arg == "--binary") {
+      options->format = WireFormat::kBinary;
+    } else {
+      return false;
+    }
+  }
+  return options->publishers > 0 && options->subscribers >= 0 && options->rate > 0.0 &&
+         options->duration_seconds > 0.0 && valid_channel_name(options->channel);
+}
+
+void raise_fd_limit() {
+  rlimit limit{};
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+
+pid_t spawn_server(const Options& options) {
+  std::vector<std::string> args = {options.server_path, std::to_string(options.port), "--quiet"};
+  args.insert(args.end(), options.server_args.begin(), options.server_args.end());
+
+  pid_t pid = fork();
+  if (pid != 0) {
+    return pid;
+  }
+  std::vector<char*> argv;
+  for (std::string& arg : args) {
+    argv.push_back(arg.data());
+  }
+  argv.push_back(nullptr);
+  execv(argv[0], argv.data());
+  std::perror("execv");
+  _exit(127);
+}
+
+bool read_process_sample(pid_t pid, ProcessSample* out) {
+  std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+  std::string content;
+  if (!std::getline(stat, content)) {
+    return false;
+  }
+  // The command name may contain spaces; fields are counted after its ')'.
+  size_t name_end = content.rfind(')');
+  if (name_end == std::string::npos) {
+    return false;
+  }
+  std::istringstream fields(content.substr(name_end + 2));
+  std::string field;
+  uint64_t utime = 0;
+  uint64_t stime = 0;
+  for (int index = 3; fields >> field; ++index) {
+    if (index == 14) {
+      utime = std::stoull(field);
+    } else if (index == 15) {
+      stime = std::stoull(field);
+      break;
+    }
+  }
+  out->cpu_seconds =
+      static_cast<double>(utime + stime) / static_cast<double>(sysconf(_SC_CLK_TCK));
+
+  std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmRSS:") == 0) {
+      out->rss_kib = std::stoull(line.substr(6));
+      break;
+    }
+  }
+  return true;
+}
+
+int connect_to(const Options& options) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(options.port));
+  if (inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr) <= 0 ||
+      connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+bool send_all(int fd, std::string_view bytes) {
+  while (!bytes.empty()) {
+    ssize_t sent = send(fd, bytes.data(), bytes.size(), MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return false;
+    }
+    bytes.remove_prefix(static_cast<size_t>(sent));
+  }
+  return true;
+}
+
+std::string encode_frame(FrameType type, uint32_t channel, std::string_view payload) {
+  FrameHeader header;
+  header.type = type;
+  header.channel = channel;
+  header.payload_size = static_cast<uint32_t>(payload.size());
+  std::string frame(kFrameHeaderSize, '\0');
+  encode_frame_header(header, reinterpret_cast<uint8_t*>(frame.data()));
+  frame.append(payload);
+  return frame;
+}
+
+// Waits for the server's hello reply; anything after it is left in *rest.
+bool negotiate_binary(int fd, std::string* rest) {
+  uint8_t hello[kHelloSize];
+  encode_hello(kFrameVersion, hello);
+  if (!send_all(fd, std::string_view(reinterpret_cast<char*>(hello), sizeof(hello)))) {
+    return false;
+  }
+  std::string received;
+  char buffer[1024];
+  while (true) {
+    size_t marker = received.find(std::string_view("\0MSF", 4));
+    if (marker != std::string::npos && received.size() - marker >= kHelloSize) {
+      *rest = received.substr(marker + kHelloSize);
+      return true;
+    }
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n <= 0) {
+      return false;
+    }
+    received.append(buffer, static_cast<size_t>(n));
+  }
+}
+
+// Subscribers listen only on the bench channel; publishers leave the lobby
+// and subscribe to nothing, so they never have to drain any fan-out.
+bool join_channel(int fd, const Options& options, bool subscribe) {
+  bool lobby = channel_id(options.channel) == kLobbyChannel;
+  std::string setup;
+  if (options.format == WireFormat::kBinary) {
+    if (subscribe && !lobby) {
+      setup += encode_frame(FrameType::kSubscribe, 0, options.channel);
+    }
+    if (!subscribe || !lobby) {
+      setup += encode_frame(FrameType::kUnsubscribe, 0, kLobbyChannelName);
+    }
+  } else {
+    if (subscribe && !lobby) {
+      setup += "/subscribe " + options.channel + "\n";
+    }
+    if (!subscribe || !lobby) {
+      setup += "/unsubscribe " + std::string(kLobbyChannelName) + "\n";
+    }
+    if (!subscribe && !lobby) {
+      setup += "/publish " + options.channel + "\n";
+    }
+  }
+  return send_all(fd, setup);
+}
+
+StatusRecord make_record(int publisher, uint64_t sequence, int64_t sent_ns) {
+  StatusRecord record;
+  record.file_id = hash_name("bench.mp4");
+  record.fps_milli = 30000;
+  record.window_w = 1280;
+  record.window_h = 720;
+  record.sent_epoch_ms = sent_ns / 1000000;
+  record.sync_anchor_epoch_ms = record.sent_epoch_ms - static_cast<int64_t>(sequence) * 33;
+  record.playhead_ms = static_cast<int64_t>(sequence) * 33;
+  record.duration_ms = 600000;
+  record.frame_index = static_cast<int64_t>(sequence) + publisher;
+  record.decoded_frames = sequence;
+  // Binary records carry the bench timestamp in pts; text lines append it.
+  record.pts = sent_ns;
+  return record;
+}
+
+std::string encode_update(const Options& options, int publisher, uint64_t sequence) {
+  int64_t sent_ns = now_ns();
+  StatusRecord record = make_record(publisher, sequence, sent_ns);
+  if (options.format == WireFormat::kBinary) {
+    uint8_t payload[kStatusRecordSize];
+    encode_status_record(record, payload);
+    return encode_frame(FrameType::kStatus, channel_id(options.channel),
+                        std::string_view(reinterpret_cast<char*>(payload), sizeof(payload)));
+  }
+  return format_status_text(record) + std::string(kTimestampField) + std::to_string(sent_ns) +
+         "\n";
+}
+
+int64_t text_timestamp(std::string_view line) {
+  size_t field = line.rfind(kTimestampField);
+  if (field == std::string_view::npos) {
+    return 0;
+  }
+  return std::strtoll(line.data() + field + kTimestampField.size(), nullptr, 10);
+}
+
+// Extracts send timestamps of every complete message in `inbound`.
+void parse_deliveries(WireFormat format, std::string* inbound, std::vector<int64_t>* sent) {
+  size_t consumed = 0;
+  if (format == WireFormat::kBinary) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(inbound->data());
+    while (inbound->size() - consumed >= kFrameHeaderSize) {
+      FrameHeader header;
+      decode_frame_header(bytes + consumed, &header);
+      size_t frame_size = kFrameHeaderSize + header.payload_size;
+      if (inbound->size() - consumed < frame_size) {
+        break;
+      }
+      StatusRecord record;
+      if (header.type == FrameType::kStatus &&
+          decode_status_record(
+              std::string_view(inbound->data() + consumed + kFrameHeaderSize, header.payload_size),
+              &record)) {
+        sent->push_back(record.pts);
+      }
+      consumed += frame_size;
+    }
+  } else {
+    while (true) {
+      size_t line_end = inbound->find('\n', consumed);
+      if (line_end == std::string::npos) {
+        break;
+      }
+      int64_t timestamp =
+          text_timestamp(std::string_view(inbound->data() + consumed, line_end - consumed));
+      if (timestamp > 0) {
+        sent->push_back(timestamp);
+      }
+      consumed = line_end + 1;
+    }
+  }
+  inbound->erase(0, consumed);
+}
+
+int64_t percentile(const std::vector<int64_t>& sorted, double q) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t index = static_cast<size_t>(q * static_cast<double>(sorted.size() - 1));
+  return sorted[index];
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!parse_args(argc, argv, &options)) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  std::signal(SIGPIPE, SIG_IGN);
+  raise_fd_limit();
+
+  pid_t spawned = 0;
+  if (!options.server_path.empty()) {
+    spawned = spawn_server(options);
+    if (spawned < 0) {
+      std::cerr << "Failed to start " << options.server_path << '\n';
+      return 1;
+    }
+    options.server_pid = spawned;
+  }
+  auto stop_server = [&]() {
+    if (spawned > 0) {
+      kill(spawned, SIGTERM);
+      waitpid(spawned, nullptr, 0);
+    }
+  };
+
+  auto deadline = std::chrono::steady_clock::now() + kServerStartTimeout;
+  int probe = -1;
+  while ((probe = connect_to(options)) < 0 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  if (probe < 0) {
+    std::cerr << "Could not connect to " << options.host << ':' << options.port << '\n';
+    stop_server();
+    return 1;
+  }
+  close(probe);
+  std::this_thread::sleep_for(kSettleTime);
+
+  ProcessSample idle_sample;
+  bool sample_server =
+      options.server_pid > 0 && read_process_sample(options.server_pid, &idle_sample);
+
+  std::vector<int> publishers;
+  std::vector<Subscriber> subscribers(static_cast<size_t>(options.subscribers));
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  for (size_t i = 0; i < subscribers.size(); ++i) {
+    Subscriber& subscriber = subscribers[i];
+    subscriber.fd = connect_to(options);
+    if (subscriber.fd < 0 ||
+        (options.format == WireFormat::kBinary &&
+         !negotiate_binary(subscriber.fd, &subscriber.inbound)) ||
+        !join_channel(subscriber.fd, options, true)) {
+      std::cerr << "Subscriber " << i << " failed to connect.\n";
+      stop_server();
+      return 1;
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = i;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, subscriber.fd, &ev);
+  }
+  for (int i = 0; i < options.publishers; ++i) {
+    int fd = connect_to(options);
+    std::string ignored;
+    if (fd < 0 || (options.format == WireFormat::kBinary && !negotiate_binary(fd, &ignored)) ||
+        !join_channel(fd, options, false)) {
+      std::cerr << "Publisher " << i << " failed to connect.\n";
+      stop_server();
+      return 1;
+    }
+    publishers.push_back(fd);
+  }
+  std::this_thread::sleep_for(kSettleTime);
+
+  ProcessSample loaded_sample;
+  if (sample_server) {
+    read_process_sample(options.server_pid, &loaded_sample);
+  }
+
+  // Receiver: drains every subscriber and timestamps deliveries.
+  std::atomic<bool> receiving{true};
+  std::vector<int64_t> latencies;
+  std::atomic<int64_t> measure_from_ns{0};
+  uint64_t stale_deliveries = 0;
+  std::thread receiver([&]() {
+    epoll_event events[kMaxEvents];
+    std::vector<char> buffer(kReceiveBufferSize);
+    std::vector<int64_t> sent;
+    while (receiving.load(std::memory_order_relaxed)) {
+      int count = epoll_wait(epoll_fd, events, kMaxEvents, 50);
+      for (int i = 0; i < count; ++i) {
+        Subscriber& subscriber = subscribers[events[i].data.u64];
+        ssize_t n = recv(subscriber.fd, buffer.data(), buffer.size(), MSG_DONTWAIT);
+        if (n <= 0) {
+          continue;
+        }
+        int64_t received_ns = now_ns();
+        subscriber.inbound.append(buffer.data(), static_cast<size_t>(n));
+        sent.clear();
+        parse_deliveries(options.format, &subscriber.inbound, &sent);
+        int64_t from_ns = measure_from_ns.load(std::memory_order_acquire);
+        for (int64_t sent_ns : sent) {
+          if (from_ns == 0 || sent_ns < from_ns) {
+            ++stale_deliveries;
+          } else {
+            latencies.push_back(received_ns - sent_ns);
+          }
+        }
+      }
+    }
+  });
+
+  // Publishers: one thread paces every publisher at `rate` updates/second,
+  // staggered so sends are spread over the interval.
+  auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(1.0 / options.rate));
+  auto start = std::chrono::steady_clock::now();
+  auto warmup_end = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                std::chrono::duration<double>(options.warmup_seconds));
+  auto end = warmup_end + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                              std::chrono::duration<double>(options.duration_seconds));
+  std::vector<std::chrono::steady_clock::time_point> next_send(publishers.size());
+  for (size_t i = 0; i < publishers.size(); ++i) {
+    next_send[i] =
+        start + interval * static_cast<int64_t>(i) / static_cast<int64_t>(publishers.size());
+  }
+  std::vector<uint64_t> sequence(publishers.size(), 0);
+  uint64_t measured_sends = 0;
+  uint64_t send_failures = 0;
+  bool measuring = false;
+  ProcessSample begin_sample;
+  while (true) {
+    auto now = std::chrono::steady_clock::now();
+    if (now >= end) {
+      break;
+    }
+    if (!measuring && now >= warmup_end) {
+      measuring = true;
+      if (sample_server) {
+        read_process_sample(options.server_pid, &begin_sample);
+      }
+      measure_from_ns.store(now_ns(), std::memory_order_release);
+    }
+    auto wake = end;
+    for (size_t i = 0; i < publishers.size(); ++i) {
+      if (next_send[i] <= now) {
+        if (send_all(publishers[i], encode_update(options, static_cast<int>(i), sequence[i]++))) {
+          measured_sends += measuring ? 1 : 0;
+        } else {
+          ++send_failures;
+        }
+        next_send[i] += interval;
+      }
+      wake = std::min(wake, next_send[i]);
+    }
+    std::this_thread::sleep_until(wake);
+  }
+  ProcessSample end_sample;
+  if (sample_server) {
+    read_process_sample(options.server_pid, &end_sample);
+  }
+
+  // Give in-flight deliveries a moment before tallying.
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  receiving.store(false);
+  receiver.join();
+
+  for (int fd : publishers) {
+    close(fd);
+  }
+  for (Subscriber& subscriber : subscribers) {
+    close(subscriber.fd);
+  }
+  close(epoll_fd);
+  stop_server();
+
+  std::sort(latencies.begin(), latencies.end());
+  double seconds = options.duration_seconds;
+  uint64_t expected = measured_sends * static_cast<uint64_t>(options.subscribers);
+  uint64_t delivered = latencies.size();
+  auto micros = [](int64_t nanos) { return static_cast<double>(nanos) / 1000.0; };
+
+  std::printf("publishers=%d subscribers=%d rate=%.1f/s duration=%.1fs format=%s\n",
+              options.publishers, options.subscribers, options.rate, seconds,
+              options.format == WireFormat::kBinary ? "binary" : "text");
+  std::printf("sent %" PRIu64 " (%.1f/s, %" PRIu64 " failed)  delivered %" PRIu64
+              " (%.1f/s)  expected %" PRIu64 "  missing %.2f%%\n",
+              measured_sends, measured_sends / seconds, send_failures, delivered,
+              delivered / seconds, expected,
+              expected > 0 ? 100.0 * (static_cast<double>(expected) - delivered) / expected : 0.0);
+  std::printf("latency us: p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f\n",
+              micros(percentile(latencies, 0.50)), micros(percentile(latencies, 0.90)),
+              micros(percentile(latencies, 0.99)), micros(percentile(latencies, 0.999)),
+              micros(latencies.empty() ? 0 : latencies.back()));
+  if (stale_deliveries > 0) {
+    std::printf("ignored %" PRIu64 " deliveries sent during warmup\n", stale_deliveries);
+  }
+  if (sample_server) {
+    double cpu = end_sample.cpu_seconds - begin_sample.cpu_seconds;
+    std::printf("server cpu: %.1f%% of a core, %.2f us/delivery, %.2f us/published\n",
+                100.0 * cpu / seconds, delivered > 0 ? cpu * 1e6 / delivered : 0.0,
+                measured_sends > 0 ? cpu * 1e6 / measured_sends : 0.0);
+    int connections = options.publishers + options.subscribers;
+    double per_connection =
+        (static_cast<double>(loaded_sample.rss_kib) - static_cast<double>(idle_sample.rss_kib)) *
+        1024.0 / connections;
+    std::printf("server rss: idle=%" PRIu64 " KiB loaded=%" PRIu64 " KiB end=%" PRIu64
+                " KiB  ~%.0f bytes/connection\n",
+                idle_sample.rss_kib, loaded_sample.rss_kib, end_sample.rss_kib, per_connection);
+  }
+  return 0;
+}
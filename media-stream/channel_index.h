@@ -0,0 +1,51 @@
+#ifndef MEDIA_STREAM_CHANNEL_INDEX_H_
+#define MEDIA_STREAM_CHANNEL_INDEX_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Channel id -> subscribed connection ids for the connections of one reactor.
+// Fan-out walks only the subscriber list of the message's channel.
+class ChannelIndex {
+ public:
+  // Returns false if the connection was already subscribed.
+  bool Subscribe(uint32_t channel, uint64_t conn_id) {
+    std::vector<uint64_t>& subscribers = subscribers_[channel];
+    if (std::find(subscribers.begin(), subscribers.end(), conn_id) != subscribers.end()) {
+      return false;
+    }
+    subscribers.push_back(conn_id);
+    return true;
+  }
+
+  // Returns false if the connection was not subscribed.
+  bool Unsubscribe(uint32_t channel, uint64_t conn_id) {
+    auto it = subscribers_.find(channel);
+    if (it == subscribers_.end()) {
+      return false;
+    }
+    std::vector<uint64_t>& subscribers = it->second;
+    auto pos = std::find(subscribers.begin(), subscribers.end(), conn_id);
+    if (pos == subscribers.end()) {
+      return false;
+    }
+    *pos = subscribers.back();
+    subscribers.pop_back();
+    if (subscribers.empty()) {
+      subscribers_.erase(it);
+    }
+    return true;
+  }
+
+  const std::vector<uint64_t>* Subscribers(uint32_t channel) const {
+    auto it = subscribers_.find(channel);
+    return it == subscribers_.end() ? nullptr : &it->second;
+  }
+
+ private:
+  std::unordered_map<uint32_t, std::vector<uint64_t>> subscribers_;
+};
+
+#endif  // MEDIA_STREAM_CHANNEL_INDEX_H_
@@ -0,0 +1,96 @@
+#ifndef MEDIA_STREAM_CHANNEL_LIMITER_H_
+#define MEDIA_STREAM_CHANNEL_LIMITER_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+#include "token_bucket.h"
+
+// Per-channel state shared by all reactors: the publish rate limit and the
+// most recent report of a subscriber falling behind. Sharded by channel id
+// so publishers on different channels rarely share a lock.
+class ChannelLimiter {
+ public:
+  // Not thread-safe; call before the reactors start. 0 disables the limit.
+  void SetRate(double messages_per_second) { rate_ = messages_per_second; }
+
+  // Returns false if the channel is over its publish rate.
+  bool Admit(uint32_t channel, int64_t now_ns) {
+    if (rate_ <= 0) {
+      return true;
+    }
+    Shard& shard = ShardFor(channel);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.channels.find(channel);
+    if (it == shard.channels.end()) {
+      it = shard.channels.emplace(channel, State{TokenBucket(rate_)}).first;
+    }
+    return it->second.bucket.TryTake(1, now_ns);
+  }
+
+  // A subscriber of `channel` has `depth` messages queued.
+  void ReportPressure(uint32_t channel, size_t depth, int64_t now_ns) {
+    Shard& shard = ShardFor(channel);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    State& state = shard.channels.try_emplace(channel, State{TokenBucket(rate_)}).first->second;
+    if (now_ns - state.pressure_ns > kPressureWindowNs || depth > state.pressure_depth) {
+      state.pressure_depth = depth;
+    }
+    state.pressure_ns = now_ns;
+  }
+
+  // Returns true and the deepest reported queue if a subscriber of `channel`
+  // fell behind within the last pressure window.
+  bool Pressure(uint32_t channel, int64_t now_ns, size_t* depth) {
+    Shard& shard = ShardFor(channel);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.channels.find(channel);
+    if (it == shard.channels.end() || it->second.pressure_ns == 0 ||
+        now_ns - it->second.pressure_ns > kPressureWindowNs) {
+      return false;
+    }
+    *depth = it->second.pressure_depth;
+    return true;
+  }
+
+  // Forgets channels with a full bucket and no recent pressure, which a new
+  // entry would reproduce, so channels that go quiet do not pile up.
+  void Prune(int64_t now_ns) {
+    for (Shard& shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      for (auto it = shard.channels.begin(); it != shard.channels.end();) {
+        const State& state = it->second;
+        if (state.bucket.Full(now_ns) && now_ns - state.pressure_ns > kPressureWindowNs) {
+          it = shard.channels.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+  }
+
+ private:
+  static constexpr int64_t kPressureWindowNs = 1000000000;
+  static constexpr size_t kShards = 16;
+
+  struct State {
+    TokenBucket bucket;
+    int64_t pressure_ns = 0;
+    size_t pressure_depth = 0;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<uint32_t, State> channels;
+  };
+
+  Shard& ShardFor(uint32_t channel) { return shards_[channel % kShards]; }
+
+  double rate_ = 0;
+  std::array<Shard, kShards> shards_;
+};
+
+#endif  // MEDIA_STREAM_CHANNEL_LIMITER_H_
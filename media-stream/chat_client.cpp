@@ -2,118 +2,945 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <cstring>
 #include <iostream>
+#include <random>
+
+#include "chat_client_pool.h"
+#include "status_record.h"
 
 namespace {
 constexpr int kBufferSize = 1024;
+constexpr int kHelloTimeoutSeconds = 2;
+constexpr int kConnectTimeoutSeconds = 2;
+constexpr size_t kDefaultOutageBufferBytes = 64 * 1024;
+constexpr size_t kDefaultReceiveSize = 64 * 1024;
+constexpr size_t kPostQueueSize = 256;
+constexpr size_t kMaxPostBatch = 64;
+// Reads per wakeup on a pool thread before other clients get a turn.
+constexpr int kMaxPooledReads = 16;
+constexpr std::string_view kHelloMagic("\0MSF", 4);
+
+void set_timeout(int fd, int option, int seconds) {
+  timeval timeout{};
+  timeout.tv_sec = seconds;
+  setsockopt(fd, SOL_SOCKET, option, &timeout, sizeof(timeout));
+}
+
+bool negotiate_binary(int fd, std::string* inbound) {
+  uint8_t hello[kHelloSize];
+  encode_hello(kFrameVersion, hello);
+  if (send(fd, hello, sizeof(hello), MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(hello))) {
+    return false;
+  }
+
+  // Text lines broadcast before the server saw our hello are discarded.
+  set_timeout(fd, SO_RCVTIMEO, kHelloTimeoutSeconds);
+  char buffer[kBufferSize];
+  bool accepted = false;
+  while (!accepted) {
+    ssize_t bytes_received = recv(fd, buffer, sizeof(buffer), 0);
+    if (bytes_received <= 0) {
+      break;
+    }
+    inbound->append(buffer, static_cast<size_t>(bytes_received));
+    size_t pos = inbound->find(kHelloMagic);
+    if (pos == std::string::npos || inbound->size() - pos < kHelloSize) {
+      continue;
+    }
+    uint8_t version = 0;
+    decode_hello(reinterpret_cast<const uint8_t*>(inbound->data() + pos), &version);
+    inbound->erase(0, pos + kHelloSize);
+    accepted = (version == kFrameVersion);
+    if (!accepted) {
+      break;
+    }
+  }
+  set_timeout(fd, SO_RCVTIMEO, 0);
+  return accepted;
+}
+
+// Writes all of `iov`, resuming after partial sends; advances `iov` as it goes.
+bool send_all(int fd, iovec* iov, int count) {
+  msghdr message{};
+  message.msg_iov = iov;
+  message.msg_iovlen = static_cast<size_t>(count);
+  while (message.msg_iovlen > 0) {
+    ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    size_t done = static_cast<size_t>(sent);
+    while (message.msg_iovlen > 0 && done >= message.msg_iov->iov_len) {
+      done -= message.msg_iov->iov_len;
+      ++message.msg_iov;
+      --message.msg_iovlen;
+    }
+    if (message.msg_iovlen > 0) {
+      message.msg_iov->iov_base = static_cast<char*>(message.msg_iov->iov_base) + done;
+      message.msg_iov->iov_len -= done;
+    }
+  }
+  return true;
+}
+
+int64_t steady_now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void print_message(const ChatClient::MessageCallback& on_message, const std::string& msg) {
+  if (on_message) {
+    on_message(msg);
+  } else {
+    std::cout << msg << std::flush;
+  }
+}
+}  // namespace
+
+ChatClient::ChatClient() : ChatClient(nullptr) {}
+
+ChatClient::ChatClient(ChatClientPool* pool)
+    : pool_(pool),
+      attached_(false),
+      sock_fd_(-1),
+      format_(WireFormat::kText),
+      port_(0),
+      publish_channel_(kLobbyChannel),
+      publish_channel_name_(kLobbyChannelName),
+      role_(ClientRole::kNone),
+      reconnect_(true),
+      initial_delay_ms_(50),
+      max_delay_ms_(1000),
+      outage_limit_(kDefaultOutageBufferBytes),
+      receive_size_(kDefaultReceiveSize),
+      received_ns_(0),
+      connected_(false),
+      receiver_running_(false),
+      stopping_(false),
+      channels_{std::string(kLobbyChannelName)},
+      outage_bytes_(0),
+      posted_(kPostQueueSize),
+      posted_offset_(0),
+      writer_idle_(false),
+      wake_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+
+ChatClient::~ChatClient() {
+  Disconnect();
+  close(wake_fd_);
+}
+
+void ChatClient::SetWireFormat(WireFormat format) { format_ = format; }
+
+void ChatClient::SetIdentity(const std::string& name, ClientRole role) {
+  name_ = name;
+  role_ = role;
 }
 
-ChatClient::ChatClient() : sock_fd_(-1), connected_(false), receiver_running_(false) {}
+void ChatClient::SetReconnect(bool enabled, int initial_delay_ms, int max_delay_ms) {
+  reconnect_ = enabled;
+  initial_delay_ms_ = std::max(1, initial_delay_ms);
+  max_delay_ms_ = std::max(initial_delay_ms_, max_delay_ms);
+}
+
+void ChatClient::SetOutageBuffer(size_t max_bytes) { outage_limit_ = max_bytes; }
 
-ChatClient::~ChatClient() { Disconnect(); }
+void ChatClient::SetReceiveSize(size_t bytes) { receive_size_ = std::max<size_t>(1, bytes); }
 
 bool ChatClient::Connect(const std::string& server_ip, int port) {
   if (connected_.load()) {
     return true;
   }
+  if (pool_ && !pool_->running_.load()) {
+    std::cerr << "Client pool is not running.\n";
+    return false;
+  }
+  if (pool_ ? attached_ : io_thread_.joinable()) {
+    if (reconnect_) {
+      return false;  // Still retrying in the background.
+    }
+    if (pool_) {
+      pool_->Detach(this);
+      attached_ = false;
+    } else {
+      io_thread_.join();
+    }
+  }
+  if (sock_fd_ >= 0) {
+    close(sock_fd_);
+    sock_fd_ = -1;
+  }
+  server_ip_ = server_ip;
+  port_ = port;
+  stopping_.store(false);
 
-  sock_fd_ = socket(AF_INET, SOCK_STREAM, 0);
-  if (sock_fd_ < 0) {
-    std::cerr << "Socket creation failed.\n";
+  std::string inbound;
+  int fd = Open(true, &inbound);
+  bool connected = false;
+  if (fd >= 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    connected = Install(fd, std::move(inbound));
+  }
+  if (!connected && !reconnect_) {
     return false;
   }
+  if (pool_) {
+    // The pool services a client only when woken, so a post must wake it.
+    writer_idle_.store(true);
+    attached_ = true;
+    pool_->Attach(this);
+    if (!connected) {
+      pool_->Reconnect(this);
+    }
+  } else {
+    io_thread_ = std::thread(&ChatClient::Run, this);
+  }
+  return connected;
+}
+
+int ChatClient::Open(bool report, std::string* inbound) const {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    if (report) {
+      std::cerr << "Socket creation failed.\n";
+    }
+    return -1;
+  }
 
   sockaddr_in server_addr{};
   server_addr.sin_family = AF_INET;
-  server_addr.sin_port = htons(static_cast<uint16_t>(port));
-  if (inet_pton(AF_INET, server_ip.c_str(), &server_addr.sin_addr) <= 0) {
-    std::cerr << "Invalid server IP: " << server_ip << '\n';
-    close(sock_fd_);
-    sock_fd_ = -1;
-    return false;
+  server_addr.sin_port = htons(static_cast<uint16_t>(port_));
+  if (inet_pton(AF_INET, server_ip_.c_str(), &server_addr.sin_addr) <= 0) {
+    if (report) {
+      std::cerr << "Invalid server IP: " << server_ip_ << '\n';
+    }
+    close(fd);
+    return -1;
   }
 
-  if (connect(sock_fd_, reinterpret_cast<sockaddr*>(&server_addr), sizeof(server_addr)) < 0) {
-    std::cerr << "Connection failed to " << server_ip << ":" << port << '\n';
+  // Bounds connect() too, so Disconnect never waits long on a retry.
+  set_timeout(fd, SO_SNDTIMEO, kConnectTimeoutSeconds);
+  if (connect(fd, reinterpret_cast<sockaddr*>(&server_addr), sizeof(server_addr)) < 0) {
+    if (report) {
+      std::cerr << "Connection failed to " << server_ip_ << ":" << port_ << '\n';
+    }
+    close(fd);
+    return -1;
+  }
+  set_timeout(fd, SO_SNDTIMEO, 0);
+
+  if (format_ == WireFormat::kBinary && !negotiate_binary(fd, inbound)) {
+    if (report) {
+      std::cerr << "Server " << server_ip_ << ":" << port_
+                << " did not accept binary framing.\n";
+    }
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool ChatClient::Install(int fd, std::string inbound) {
+  sock_fd_ = fd;
+  inbound_.Clear();
+  inbound_.Append(inbound);
+  connected_.store(true);
+
+  bool ok = true;
+  if (!name_.empty()) {
+    ok = format_ == WireFormat::kBinary
+             ? WriteFrameLocked(FrameType::kRegister, kLobbyChannel,
+                                encode_register_payload(role_, name_))
+             : WriteLineLocked("/register " + name_ + " " + client_role_name(role_) + "\n");
+  }
+  if (ok && format_ == WireFormat::kText && publish_channel_ != kLobbyChannel) {
+    ok = WriteLineLocked("/publish " + publish_channel_name_ + "\n");
+  }
+  // The server subscribes every new connection to the lobby.
+  bool lobby = false;
+  for (size_t i = 0; ok && i < channels_.size(); ++i) {
+    if (channels_[i] == kLobbyChannelName) {
+      lobby = true;
+    } else {
+      ok = WriteMembershipLocked(FrameType::kSubscribe, channels_[i]);
+    }
+  }
+  if (ok && !lobby) {
+    ok = WriteMembershipLocked(FrameType::kUnsubscribe, std::string(kLobbyChannelName));
+  }
+  while (ok && !outage_.empty()) {
+    iovec iov{outage_.front().data(), outage_.front().size()};
+    ok = WriteLocked(&iov, 1);
+    if (ok) {
+      outage_bytes_ -= outage_.front().size();
+      outage_.pop_front();
+    }
+  }
+  if (!ok) {
     close(sock_fd_);
     sock_fd_ = -1;
-    return false;
+    inbound_.Clear();
   }
+  return ok;
+}
 
-  connected_.store(true);
-  return true;
+bool ChatClient::Retrying() const {
+  return reconnect_ && !server_ip_.empty() && !stopping_.load();
 }
 
 bool ChatClient::SendLine(const std::string& text) {
-  if (!connected_.load() || sock_fd_ < 0) {
-    return false;
+  if (format_ == WireFormat::kBinary) {
+    std::string_view payload(text);
+    if (!payload.empty() && payload.back() == '\n') {
+      payload.remove_suffix(1);
+    }
+    return SendFrame(FrameType::kData, publish_channel_, payload);
   }
 
   std::string line = text;
   if (line.empty() || line.back() != '\n') {
     line.push_back('\n');
   }
+  iovec iov{line.data(), line.size()};
+  return Send(&iov, 1);
+}
+
+bool ChatClient::SendFrame(FrameType type, uint32_t channel, std::string_view payload) {
+  if (format_ != WireFormat::kBinary || payload.size() > kMaxFramePayload) {
+    return false;
+  }
 
-  ssize_t sent = send(sock_fd_, line.c_str(), line.size(), 0);
-  if (sent < 0) {
-    connected_.store(false);
+  FrameHeader header;
+  header.type = type;
+  header.channel = channel;
+  header.payload_size = static_cast<uint32_t>(payload.size());
+  uint8_t header_bytes[kFrameHeaderSize];
+  encode_frame_header(header, header_bytes);
+
+  iovec iov[2];
+  iov[0].iov_base = header_bytes;
+  iov[0].iov_len = sizeof(header_bytes);
+  iov[1].iov_base = const_cast<char*>(payload.data());
+  iov[1].iov_len = payload.size();
+  return Send(iov, 2);
+}
+
+bool ChatClient::Send(iovec* iov, int count) {
+  // WriteLocked advances the iovecs; a failed write is resent whole.
+  iovec original[2];
+  std::copy(iov, iov + count, original);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (connected_.load() && WriteLocked(iov, count)) {
+    return true;
+  }
+  if (!Retrying() || outage_limit_ == 0) {
     return false;
   }
+  std::string message;
+  for (int i = 0; i < count; ++i) {
+    message.append(static_cast<const char*>(original[i].iov_base), original[i].iov_len);
+  }
+  return BufferLocked(std::move(message));
+}
+
+bool ChatClient::PostLine(std::string_view text) {
+  if (format_ == WireFormat::kBinary) {
+    if (!text.empty() && text.back() == '\n') {
+      text.remove_suffix(1);
+    }
+    return PostFrame(FrameType::kData, publish_channel_, text);
+  }
+  return Post(text, text.empty() || text.back() != '\n' ? "\n" : "");
+}
+
+bool ChatClient::PostFrame(FrameType type, uint32_t channel, std::string_view payload) {
+  if (format_ != WireFormat::kBinary || payload.size() > kMaxFramePayload) {
+    return false;
+  }
+
+  FrameHeader header;
+  header.type = type;
+  header.channel = channel;
+  header.payload_size = static_cast<uint32_t>(payload.size());
+  uint8_t header_bytes[kFrameHeaderSize];
+  encode_frame_header(header, header_bytes);
+  return Post(std::string_view(reinterpret_cast<const char*>(header_bytes), sizeof(header_bytes)),
+              payload);
+}
+
+bool ChatClient::Post(std::string_view head, std::string_view body) {
+  if ((!connected_.load() && !Retrying()) || !posted_.Push(head, body)) {
+    return false;
+  }
+  // Pairs with the fence in Run: either the I/O thread sees the message
+  // before it sleeps or this sees it asleep.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (writer_idle_.exchange(false)) {
+    Wake();
+  }
   return true;
 }
 
+void ChatClient::Wake() { eventfd_write(wake_fd_, 1); }
+
+bool ChatClient::BufferLocked(std::string message) {
+  if (!Retrying() || outage_limit_ == 0 || message.size() > outage_limit_) {
+    return false;
+  }
+  outage_bytes_ += message.size();
+  outage_.push_back(std::move(message));
+  while (outage_bytes_ > outage_limit_) {
+    outage_bytes_ -= outage_.front().size();
+    outage_.pop_front();
+  }
+  return true;
+}
+
+bool ChatClient::WriteLocked(iovec* iov, int count) {
+  if (FinishPostedLocked() && send_all(sock_fd_, iov, count)) {
+    return true;
+  }
+  // Wakes the I/O thread, which closes the socket and reconnects.
+  connected_.store(false);
+  shutdown(sock_fd_, SHUT_RDWR);
+  return false;
+}
+
+bool ChatClient::WriteLineLocked(const std::string& line) {
+  iovec iov{const_cast<char*>(line.data()), line.size()};
+  return WriteLocked(&iov, 1);
+}
+
+bool ChatClient::WriteFrameLocked(FrameType type, uint32_t channel, std::string_view payload) {
+  FrameHeader header;
+  header.type = type;
+  header.channel = channel;
+  header.payload_size = static_cast<uint32_t>(payload.size());
+  uint8_t header_bytes[kFrameHeaderSize];
+  encode_frame_header(header, header_bytes);
+
+  iovec iov[2];
+  iov[0].iov_base = header_bytes;
+  iov[0].iov_len = sizeof(header_bytes);
+  iov[1].iov_base = const_cast<char*>(payload.data());
+  iov[1].iov_len = payload.size();
+  return WriteLocked(iov, 2);
+}
+
+bool ChatClient::WriteMembershipLocked(FrameType type, const std::string& channel) {
+  if (format_ == WireFormat::kBinary) {
+    return WriteFrameLocked(type, channel_id(channel), channel);
+  }
+  return WriteLineLocked((type == FrameType::kSubscribe ? "/subscribe " : "/unsubscribe ") +
+                         channel + "\n");
+}
+
+bool ChatClient::Subscribe(const std::string& channel) {
+  if (!valid_channel_name(channel)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (std::find(channels_.begin(), channels_.end(), channel) == channels_.end()) {
+    channels_.push_back(channel);
+  }
+  if (connected_.load() && WriteMembershipLocked(FrameType::kSubscribe, channel)) {
+    return true;
+  }
+  return Retrying();
+}
+
+bool ChatClient::Unsubscribe(const std::string& channel) {
+  if (!valid_channel_name(channel)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  channels_.erase(std::remove(channels_.begin(), channels_.end(), channel), channels_.end());
+  if (connected_.load() && WriteMembershipLocked(FrameType::kUnsubscribe, channel)) {
+    return true;
+  }
+  return Retrying();
+}
+
+bool ChatClient::Replay(const std::string& channel, ReplayFrom from, uint64_t start) {
+  if (!valid_channel_name(channel)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!connected_.load()) {
+    return false;
+  }
+  if (format_ == WireFormat::kBinary) {
+    std::string payload(9, '\0');
+    payload[0] = static_cast<char>(from);
+    put_u64(reinterpret_cast<uint8_t*>(&payload[1]), start);
+    payload.append(channel);
+    return WriteFrameLocked(FrameType::kReplay, channel_id(channel), payload);
+  }
+  return WriteLineLocked("/replay " + channel + (from == ReplayFrom::kTime ? " since " : " seq ") +
+                         std::to_string(start) + "\n");
+}
+
+bool ChatClient::SetPublishChannel(const std::string& channel) {
+  if (!valid_channel_name(channel)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  publish_channel_ = channel_id(channel);
+  publish_channel_name_ = channel;
+  if (format_ == WireFormat::kBinary || !connected_.load()) {
+    return true;
+  }
+  return WriteLineLocked("/publish " + channel + "\n") || Retrying();
+}
+
+bool ChatClient::SyncClock() {
+  return PostFrame(FrameType::kTimeSync, kLobbyChannel, encode_time_sync_request(steady_now_ns()));
+}
+
+bool ChatClient::ServerTimeNs(int64_t* server_ns) const {
+  std::lock_guard<std::mutex> lock(clock_mutex_);
+  if (!clock_.Synced()) {
+    return false;
+  }
+  *server_ns = clock_.ToServer(steady_now_ns());
+  return true;
+}
+
+ClockSync ChatClient::Clock() const {
+  std::lock_guard<std::mutex> lock(clock_mutex_);
+  return clock_;
+}
+
 void ChatClient::StartReceiver(MessageCallback on_message) {
-  if (!connected_.load() || receiver_running_.load()) {
+  if ((!connected_.load() && !Retrying()) || receiver_running_.load()) {
     return;
   }
   on_message_ = std::move(on_message);
   receiver_running_.store(true);
-  receiver_thread_ = std::thread(&ChatClient::ReceiveLoop, this);
+  if (!pool_ && !io_thread_.joinable()) {
+    io_thread_ = std::thread(&ChatClient::Run, this);
+  }
+  Wake();
+}
+
+void ChatClient::StartFrameReceiver(FrameCallback on_frame) {
+  on_frame_ = std::move(on_frame);
+  StartReceiver(nullptr);
+}
+
+void ChatClient::StartLineReceiver(LineCallback on_line) {
+  on_line_ = std::move(on_line);
+  StartReceiver(nullptr);
 }
 
 void ChatClient::StopReceiver() {
   receiver_running_.store(false);
-  if (receiver_thread_.joinable()) {
-    receiver_thread_.join();
-  }
+  Wake();
 }
 
 void ChatClient::Disconnect() {
-  receiver_running_.store(false);
-  if (sock_fd_ >= 0) {
-    shutdown(sock_fd_, SHUT_RDWR);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (connected_.load()) {
+      FlushPostedLocked(true);
+    }
+    stopping_.store(true);
+    receiver_running_.store(false);
+    if (sock_fd_ >= 0) {
+      shutdown(sock_fd_, SHUT_RDWR);
+    }
+    outage_.clear();
+    outage_bytes_ = 0;
+  }
+  state_changed_.notify_all();
+  Wake();
+  if (attached_) {
+    pool_->Detach(this);
+    attached_ = false;
   }
-  if (receiver_thread_.joinable()) {
-    receiver_thread_.join();
+  if (io_thread_.joinable()) {
+    io_thread_.join();
   }
   if (sock_fd_ >= 0) {
     close(sock_fd_);
     sock_fd_ = -1;
   }
+  posted_.Pop(posted_.Size());
+  posted_offset_ = 0;
   connected_.store(false);
 }
 
 bool ChatClient::IsConnected() const { return connected_.load(); }
 
-void ChatClient::ReceiveLoop() {
-  char buffer[kBufferSize];
-  while (receiver_running_.load() && connected_.load()) {
-    std::memset(buffer, 0, sizeof(buffer));
-    ssize_t bytes_received = recv(sock_fd_, buffer, sizeof(buffer) - 1, 0);
-    if (bytes_received <= 0) {
+bool ChatClient::FinishPostedLocked() {
+  if (posted_offset_ == 0) {
+    return true;
+  }
+  const std::string& message = posted_.At(0);
+  iovec iov{const_cast<char*>(message.data()) + posted_offset_, message.size() - posted_offset_};
+  if (!send_all(sock_fd_, &iov, 1)) {
+    return false;
+  }
+  posted_.Pop(1);
+  posted_offset_ = 0;
+  return true;
+}
+
+bool ChatClient::FlushPostedLocked(bool block) {
+  int flags = MSG_NOSIGNAL | (block ? 0 : MSG_DONTWAIT);
+  while (connected_.load()) {
+    size_t queued = std::min(posted_.Size(), kMaxPostBatch);
+    if (queued == 0) {
+      return true;
+    }
+    iovec iov[kMaxPostBatch];
+    for (size_t i = 0; i < queued; ++i) {
+      const std::string& message = posted_.At(i);
+      iov[i].iov_base = const_cast<char*>(message.data());
+      iov[i].iov_len = message.size();
+    }
+    iov[0].iov_base = static_cast<char*>(iov[0].iov_base) + posted_offset_;
+    iov[0].iov_len -= posted_offset_;
+    msghdr message{};
+    message.msg_iov = iov;
+    message.msg_iovlen = queued;
+    ssize_t sent = sendmsg(sock_fd_, &message, flags);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return false;
+      }
+      connected_.store(false);
+      shutdown(sock_fd_, SHUT_RDWR);
+      return true;
+    }
+    size_t done = posted_offset_ + static_cast<size_t>(sent);
+    size_t written = 0;
+    while (written < queued && done >= posted_.At(written).size()) {
+      done -= posted_.At(written).size();
+      ++written;
+    }
+    posted_.Pop(written);
+    posted_offset_ = done;
+  }
+  return true;
+}
+
+void ChatClient::BufferPostedLocked() {
+  // A message partly written to the old connection is resent whole.
+  posted_offset_ = 0;
+  for (size_t queued = posted_.Size(); queued > 0; --queued) {
+    BufferLocked(posted_.At(0));
+    posted_.Pop(1);
+  }
+}
+
+void ChatClient::Run() {
+  while (!stopping_.load()) {
+    if (sock_fd_ < 0) {
+      if (!reconnect_) {
+        break;
+      }
+      Reconnect();
+      continue;
+    }
+    if (!connected_.load()) {
+      DropConnection();
+      continue;
+    }
+    bool blocked = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      blocked = !FlushPostedLocked(false);
+    }
+    bool receiving = receiver_running_.load();
+    if (receiving && format_ == WireFormat::kBinary && !inbound_.Empty()) {
+      DispatchFrames();
+    }
+
+    pollfd fds[2];
+    fds[0].fd = sock_fd_;
+    fds[0].events = POLLRDHUP | (receiving ? POLLIN : 0) | (blocked ? POLLOUT : 0);
+    fds[0].revents = 0;
+    fds[1].fd = wake_fd_;
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+    writer_idle_.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!blocked && posted_.Size() > 0) {
+      writer_idle_.store(false);
+      continue;
+    }
+    int ready = poll(fds, 2, -1);
+    writer_idle_.store(false);
+    if (ready <= 0) {
+      continue;
+    }
+    if (fds[1].revents & POLLIN) {
+      eventfd_t wakeups = 0;
+      eventfd_read(wake_fd_, &wakeups);
+    }
+    if (fds[0].revents & POLLIN) {
+      if (ReadOnce() == 0) {
+        DropConnection();
+      }
+    } else if (fds[0].revents & (POLLRDHUP | POLLHUP | POLLERR)) {
+      // Nobody reads, so only a hangup matters.
+      DropConnection();
+    }
+  }
+  receiver_running_.store(false);
+}
+
+void ChatClient::Reconnect() {
+  // Equal jitter: half the delay is fixed, so retries keep backing off, and
+  // half is random, so clients dropped together do not return in lockstep.
+  std::mt19937 random(std::random_device{}());
+  int delay_ms = initial_delay_ms_;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_.load()) {
+    BufferPostedLocked();
+    std::uniform_int_distribution<int> jitter(delay_ms / 2, delay_ms);
+    if (state_changed_.wait_for(lock, std::chrono::milliseconds(jitter(random)),
+                                [this] { return stopping_.load(); })) {
+      return;
+    }
+    lock.unlock();
+    std::string inbound;
+    int fd = Open(false, &inbound);
+    lock.lock();
+    if (fd >= 0 && stopping_.load()) {
+      close(fd);
+      return;
+    }
+    BufferPostedLocked();
+    if (fd >= 0 && Install(fd, std::move(inbound))) {
+      std::cerr << "Reconnected to " << server_ip_ << ":" << port_ << ".\n";
+      return;
+    }
+    delay_ms = std::min(delay_ms * 2, max_delay_ms_);
+  }
+}
+
+ssize_t ChatClient::ReadOnce() {
+  ssize_t bytes_received =
+      recv(sock_fd_, inbound_.Reserve(receive_size_), receive_size_, MSG_DONTWAIT);
+  if (bytes_received < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return -1;
+  }
+  if (bytes_received <= 0) {
+    return 0;
+  }
+  inbound_.Commit(static_cast<size_t>(bytes_received));
+  received_ns_ = steady_now_ns();
+  if (format_ == WireFormat::kBinary) {
+    DispatchFrames();
+  } else {
+    DispatchLines();
+  }
+  return bytes_received;
+}
+
+void ChatClient::Service(bool hangup) {
+  if (sock_fd_ < 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    BufferPostedLocked();
+    return;
+  }
+  if (connected_.load()) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    FlushPostedLocked(false);
+  }
+  if (receiver_running_.load() && connected_.load()) {
+    if (format_ == WireFormat::kBinary && !inbound_.Empty()) {
+      DispatchFrames();
+    }
+    ssize_t bytes_received = -1;
+    int reads = 0;
+    while (reads < kMaxPooledReads && (bytes_received = ReadOnce()) > 0) {
+      ++reads;
+    }
+    if (reads == kMaxPooledReads) {
+      Wake();  // Edge-triggered: nothing else reports the rest.
+    }
+    hangup = hangup || bytes_received == 0;
+  }
+  if (hangup || !connected_.load()) {
+    DropConnection();
+    return;
+  }
+  writer_idle_.store(true);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (posted_.Size() > 0 && writer_idle_.exchange(false)) {
+    Wake();
+  }
+}
+
+bool ChatClient::Adopt(int fd, std::string inbound) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (stopping_.load()) {
+    close(fd);
+    return false;
+  }
+  BufferPostedLocked();
+  if (!Install(fd, std::move(inbound))) {
+    return false;
+  }
+  std::cerr << "Reconnected to " << server_ip_ << ":" << port_ << ".\n";
+  return true;
+}
+
+void ChatClient::DropConnection() {
+  if (reconnect_ && !stopping_.load()) {
+    std::cerr << "Lost connection to " << server_ip_ << ":" << port_ << ", reconnecting.\n";
+  }
+  // Unblocks a sender stuck on the dead socket before taking its lock.
+  shutdown(sock_fd_, SHUT_RDWR);
+  std::lock_guard<std::mutex> lock(mutex_);
+  connected_.store(false);
+  close(sock_fd_);
+  sock_fd_ = -1;
+  inbound_.Clear();
+  BufferPostedLocked();
+  if (pool_ && reconnect_ && !stopping_.load()) {
+    pool_->Reconnect(this);
+  }
+}
+
+void ChatClient::DispatchFrames() {
+  std::string_view data = inbound_.Data();
+  size_t consumed = 0;
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+  while (data.size() - consumed >= kFrameHeaderSize) {
+    FrameView frame;
+    if (!decode_frame_header(bytes + consumed, &frame.header)) {
+      std::cerr << "Received an invalid frame header, disconnecting.\n";
       connected_.store(false);
+      shutdown(sock_fd_, SHUT_RDWR);
+      inbound_.Clear();
+      return;
+    }
+    size_t frame_size = kFrameHeaderSize + frame.header.payload_size;
+    if (data.size() - consumed < frame_size) {
       break;
     }
-    std::string msg(buffer, static_cast<size_t>(bytes_received));
-    if (on_message_) {
-      on_message_(msg);
+    frame.payload = data.substr(consumed + kFrameHeaderSize, frame.header.payload_size);
+    consumed += frame_size;
+
+    int64_t probe_ns = 0;
+    int64_t server_ns = 0;
+    if (frame.header.type == FrameType::kTimeSync) {
+      if (decode_time_sync_reply(frame.payload, &probe_ns, &server_ns)) {
+        std::lock_guard<std::mutex> lock(clock_mutex_);
+        clock_.AddSample(probe_ns, server_ns, received_ns_);
+      }
+      continue;
+    }
+
+    ClientRole role = ClientRole::kNone;
+    std::string_view name;
+    bool registration = frame.header.type == FrameType::kRegister &&
+                        decode_register_payload(frame.payload, &role, &name);
+    if (registration) {
+      sender_names_[frame.header.sender_id] = std::string(name);
+    }
+    if (on_frame_) {
+      DeliverFrame(frame);
+      continue;
+    }
+    uint32_t depth = 0;
+    bool backpressure = frame.header.type == FrameType::kBackpressure &&
+                        decode_backpressure_payload(frame.payload, &depth);
+    rendered_.clear();
+    if (frame.header.type != FrameType::kNotice && !registration && !backpressure) {
+      auto known = sender_names_.find(frame.header.sender_id);
+      if (known != sender_names_.end()) {
+        rendered_.append(known->second);
+      } else {
+        rendered_.append("Client").append(std::to_string(frame.header.sender_id));
+      }
+      rendered_.append(": ");
+    }
+    StatusRecord record;
+    if (registration) {
+      rendered_.append(registration_text(name, role));
+    } else if (backpressure) {
+      rendered_.append(backpressure_text(depth));
+    } else if (frame.header.type == FrameType::kStatus &&
+               decode_status_record(frame.payload, &record)) {
+      char text[kStatusTextSize];
+      rendered_.append(text, format_status_text(record, text));
     } else {
-      std::cout << msg << std::flush;
+      rendered_.append(frame.payload);
     }
+    if (on_line_) {
+      DeliverLine(rendered_);
+      continue;
+    }
+    rendered_.push_back('\n');
+    DeliverMessage(rendered_);
   }
-  receiver_running_.store(false);
+  inbound_.Consume(consumed);
+}
+
+void ChatClient::DispatchLines() {
+  std::string_view data = inbound_.Data();
+  if (!on_line_) {
+    DeliverMessage(std::string(data));
+    inbound_.Consume(data.size());
+    return;
+  }
+  size_t consumed = 0;
+  for (size_t newline = data.find('\n'); newline != std::string_view::npos;
+       newline = data.find('\n', consumed)) {
+    DeliverLine(data.substr(consumed, newline - consumed));
+    consumed = newline + 1;
+  }
+  // A server never sends lines this long; do not buffer one forever.
+  if (data.size() - consumed >= kMaxFramePayload) {
+    DeliverLine(data.substr(consumed));
+    consumed = data.size();
+  }
+  inbound_.Consume(consumed);
+}
+
+void ChatClient::DeliverFrame(const FrameView& frame) {
+  if (!pool_ || !pool_->executor_) {
+    on_frame_(frame);
+    return;
+  }
+  pool_->executor_([this, header = frame.header, payload = std::string(frame.payload)] {
+    on_frame_(FrameView{header, payload});
+  });
+}
+
+void ChatClient::DeliverLine(std::string_view line) {
+  if (!pool_ || !pool_->executor_) {
+    on_line_(line);
+    return;
+  }
+  pool_->executor_([this, line = std::string(line)] { on_line_(line); });
+}
+
+void ChatClient::DeliverMessage(const std::string& msg) {
+  if (pool_ && pool_->executor_) {
+    pool_->executor_([this, msg] { print_message(on_message_, msg); });
+    return;
+  }
+  print_message(on_message_, msg);
 }
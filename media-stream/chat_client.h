@@ -1,33 +1,187 @@
 #ifndef MEDIA_STREAM_CHAT_CLIENT_H_
 #define MEDIA_STREAM_CHAT_CLIENT_H_
 
+#include <sys/types.h>
+#include <sys/uio.h>
+
 #include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
 #include <functional>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "clock_sync.h"
+#include "frame.h"
+#include "receive_buffer.h"
+#include "send_queue.h"
+
+class ChatClientPool;
 
 class ChatClient {
  public:
   using MessageCallback = std::function<void(const std::string&)>;
+  using FrameCallback = std::function<void(const FrameView&)>;
+  using LineCallback = std::function<void(std::string_view)>;
 
   ChatClient();
+  // Joins `pool`, whose threads then do this client's I/O and reconnects
+  // instead of a thread of its own. The pool must be started first.
+  explicit ChatClient(ChatClientPool* pool);
   ~ChatClient();
 
+  // Must be called before Connect. kBinary negotiates length-prefixed framing
+  // with the server during Connect.
+  void SetWireFormat(WireFormat format);
+  // Must be called before Connect. The name is registered on every connect,
+  // so the server keeps the same sender id for this client across reconnects.
+  void SetIdentity(const std::string& name, ClientRole role);
+  // Must be called before Connect. While enabled (the default), a dropped
+  // connection, or a failed first Connect, is retried in the background with
+  // jittered exponential backoff from `initial_delay_ms` up to
+  // `max_delay_ms`. Each reconnect restores the registration, subscriptions
+  // and publish channel before anything else is sent.
+  void SetReconnect(bool enabled, int initial_delay_ms = 50, int max_delay_ms = 1000);
+  // Must be called before Connect. While reconnecting, SendLine and SendFrame
+  // keep up to `max_bytes` of messages, dropping the oldest, and send them
+  // once reconnected. 0 makes them fail instead.
+  void SetOutageBuffer(size_t max_bytes);
+  // Must be called before Connect. Bytes read from the socket at a time;
+  // 64 KiB by default.
+  void SetReceiveSize(size_t bytes);
+
   bool Connect(const std::string& server_ip, int port);
   bool SendLine(const std::string& text);
+  bool SendFrame(FrameType type, uint32_t channel, std::string_view payload);
+  // Like SendLine and SendFrame, but only queue the message for the I/O
+  // thread, which batches queued messages into one write; never blocks on
+  // the network. Only one thread may post. Returns false if the queue is full
+  // because the server is not keeping up. Posted messages keep their order
+  // among themselves and follow the outage buffer rules while reconnecting;
+  // Disconnect still sends those queued.
+  bool PostLine(std::string_view text);
+  bool PostFrame(FrameType type, uint32_t channel, std::string_view payload);
+
+  // Channel membership. Connections start subscribed to and publishing on
+  // the lobby; SendLine publishes to the channel chosen by SetPublishChannel.
+  bool Subscribe(const std::string& channel);
+  bool Unsubscribe(const std::string& channel);
+  bool SetPublishChannel(const std::string& channel);
+  uint32_t PublishChannelId() const { return publish_channel_; }
+  // Asks a server running with --log-dir to resend what was logged on
+  // `channel` from a sequence number or unix time in milliseconds. The
+  // messages arrive like live ones, followed by a notice naming the next seq.
+  bool Replay(const std::string& channel, ReplayFrom from, uint64_t start);
+  // Posts a probe of the server's clock (binary mode only). The receiver
+  // consumes the replies, each refining the estimate below; probe a few times
+  // in quick succession, then every second or so to follow drift.
+  bool SyncClock();
+  // The server's Unix time in nanoseconds, estimated from the probes; false
+  // before the first reply.
+  bool ServerTimeNs(int64_t* server_ns) const;
+  ClockSync Clock() const;
+  // In binary mode, text receivers get each frame rendered as a text line.
   void StartReceiver(MessageCallback on_message = nullptr);
+  void StartFrameReceiver(FrameCallback on_frame);
+  // Delivers each complete line without its newline (in binary mode, each
+  // frame rendered as text) as a view that is valid during the call only.
+  // Lines are parsed in place, with no allocation per line.
+  void StartLineReceiver(LineCallback on_line);
   void StopReceiver();
   void Disconnect();
+  // False while reconnecting.
   bool IsConnected() const;
 
  private:
-  void ReceiveLoop();
+  friend class ChatClientPool;
 
+  int Open(bool report, std::string* inbound) const;
+  bool Install(int fd, std::string inbound);
+  bool Retrying() const;
+  bool Send(iovec* iov, int count);
+  bool Post(std::string_view head, std::string_view body);
+  bool BufferLocked(std::string message);
+  bool FinishPostedLocked();
+  bool FlushPostedLocked(bool block);
+  void BufferPostedLocked();
+  void Wake();
+  bool WriteLocked(iovec* iov, int count);
+  bool WriteLineLocked(const std::string& line);
+  bool WriteFrameLocked(FrameType type, uint32_t channel, std::string_view payload);
+  bool WriteMembershipLocked(FrameType type, const std::string& channel);
+  void Run();
+  void Reconnect();
+  void DropConnection();
+  // Returns the bytes read, 0 once the connection is gone, or -1 if nothing
+  // is available yet.
+  ssize_t ReadOnce();
+  // Pool I/O thread: writes what was posted, reads what arrived and handles
+  // a hangup.
+  void Service(bool hangup);
+  // Pool I/O thread: installs a socket the pool reconnected.
+  bool Adopt(int fd, std::string inbound);
+  void DispatchFrames();
+  void DispatchLines();
+  // Run the receive callback, or hand a copy to the pool's executor.
+  void DeliverFrame(const FrameView& frame);
+  void DeliverLine(std::string_view line);
+  void DeliverMessage(const std::string& msg);
+
+  ChatClientPool* pool_;
+  bool attached_;
   int sock_fd_;
+  WireFormat format_;
+  std::string server_ip_;
+  int port_;
+  uint32_t publish_channel_;
+  std::string publish_channel_name_;
+  std::string name_;
+  ClientRole role_;
+  bool reconnect_;
+  int initial_delay_ms_;
+  int max_delay_ms_;
+  size_t outage_limit_;
+  // Names announced by registrations seen on the lobby, by sender id.
+  std::unordered_map<uint32_t, std::string> sender_names_;
+  size_t receive_size_;
+  ReceiveBuffer inbound_;
+  // Reused for every frame rendered as text.
+  std::string rendered_;
+  // steady_clock time of the last read, when clock probe replies arrived.
+  int64_t received_ns_;
+  mutable std::mutex clock_mutex_;
+  ClockSync clock_;
   std::atomic<bool> connected_;
   std::atomic<bool> receiver_running_;
-  std::thread receiver_thread_;
+  std::atomic<bool> stopping_;
+
+  // Guards writes to the socket and replacing it, and everything below.
+  std::mutex mutex_;
+  std::condition_variable state_changed_;
+  // Channels to be subscribed to after a reconnect, the lobby included.
+  std::vector<std::string> channels_;
+  std::deque<std::string> outage_;
+  size_t outage_bytes_;
+  // Messages posted but not fully written; the first has `posted_offset_`
+  // bytes on the wire already.
+  SendQueue posted_;
+  size_t posted_offset_;
+
+  // Set while the I/O thread sleeps in poll; a poster clearing it wakes it.
+  std::atomic<bool> writer_idle_;
+  int wake_fd_;
+
+  // Receives while a receiver is started, writes posted messages and
+  // reconnects while enabled.
+  std::thread io_thread_;
   MessageCallback on_message_;
+  FrameCallback on_frame_;
+  LineCallback on_line_;
 };
 
 #endif  // MEDIA_STREAM_CHAT_CLIENT_H_
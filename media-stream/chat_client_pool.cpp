@@ -0,0 +1,284 @@
+#include "chat_client_pool.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+
+#include "chat_client.h"
+
+namespace {
+constexpr int kMaxEvents = 64;
+constexpr uint64_t kWakeTag = 0;
+// Set in the tag of a client's wake eventfd, clear in its socket's tag.
+constexpr uint64_t kClientWakeBit = 1;
+
+bool add_to_epoll(int epoll_fd, int fd, uint32_t events, uint64_t tag) {
+  epoll_event ev{};
+  ev.events = events;
+  ev.data.u64 = tag;
+  return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+uint64_t client_tag(ChatClient* client) { return reinterpret_cast<uintptr_t>(client); }
+}  // namespace
+
+ChatClientPool::ChatClientPool(Executor executor)
+    : executor_(std::move(executor)),
+      epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+      wake_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      running_(false),
+      random_(std::random_device{}()) {
+  if (epoll_fd_ >= 0 && wake_fd_ >= 0) {
+    add_to_epoll(epoll_fd_, wake_fd_, EPOLLIN | EPOLLET, kWakeTag);
+  }
+}
+
+ChatClientPool::~ChatClientPool() {
+  Stop();
+  if (wake_fd_ >= 0) {
+    close(wake_fd_);
+  }
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+  }
+}
+
+bool ChatClientPool::Start() {
+  if (epoll_fd_ < 0 || wake_fd_ < 0) {
+    std::cerr << "Client pool: epoll/eventfd creation failed.\n";
+    return false;
+  }
+  if (running_.load()) {
+    return true;
+  }
+  running_.store(true);
+  io_thread_ = std::thread(&ChatClientPool::Run, this);
+  connector_thread_ = std::thread(&ChatClientPool::RunConnector, this);
+  return true;
+}
+
+void ChatClientPool::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_.store(false);
+  }
+  changed_.notify_all();
+  eventfd_write(wake_fd_, 1);
+  if (io_thread_.joinable()) {
+    io_thread_.join();
+  }
+  if (connector_thread_.joinable()) {
+    connector_thread_.join();
+  }
+}
+
+void ChatClientPool::Attach(ChatClient* client) {
+  Submit(Request{Command::kAttach, client, -1, {}, 0});
+}
+
+void ChatClientPool::Submit(Request request) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    mailbox_.push_back(std::move(request));
+    ++submitted_;
+  }
+  eventfd_write(wake_fd_, 1);
+}
+
+void ChatClientPool::Detach(ChatClient* client) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [&] { return connecting_ != client; });
+  retries_.erase(std::remove_if(retries_.begin(), retries_.end(),
+                                [&](const Retry& retry) { return retry.client == client; }),
+                 retries_.end());
+  if (!running_.load()) {
+    for (const Request& request : mailbox_) {
+      if (request.client == client && request.fd >= 0) {
+        close(request.fd);
+      }
+    }
+    mailbox_.erase(std::remove_if(mailbox_.begin(), mailbox_.end(),
+                                  [&](const Request& request) { return request.client == client; }),
+                   mailbox_.end());
+    lock.unlock();
+    Unwatch(client);
+    return;
+  }
+  mailbox_.push_back(Request{Command::kDetach, client, -1, {}, 0});
+  uint64_t ticket = ++submitted_;
+  eventfd_write(wake_fd_, 1);
+  changed_.wait(lock, [&] { return completed_ >= ticket; });
+}
+
+void ChatClientPool::Reconnect(ChatClient* client, int delay_ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (delay_ms <= 0) {
+    delay_ms = client->initial_delay_ms_;
+  }
+  // Same equal-jitter backoff as a client reconnecting on its own thread.
+  std::uniform_int_distribution<int> jitter(delay_ms / 2, delay_ms);
+  retries_.push_back(Retry{client,
+                           std::chrono::steady_clock::now() +
+                               std::chrono::milliseconds(jitter(random_)),
+                           delay_ms});
+  changed_.notify_all();
+}
+
+void ChatClientPool::Run() {
+  epoll_event events[kMaxEvents];
+  std::vector<ChatClient*> detached;
+  while (running_.load()) {
+    int count = epoll_wait(epoll_fd_, events, kMaxEvents, -1);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "Client pool: epoll_wait failed.\n";
+      break;
+    }
+
+    detached.clear();
+    uint64_t drained = 0;
+    for (int i = 0; i < count; ++i) {
+      uint64_t tag = events[i].data.u64;
+      if (tag == kWakeTag) {
+        eventfd_t wakeups = 0;
+        eventfd_read(wake_fd_, &wakeups);
+        drained = std::max(drained, DrainMailbox(&detached));
+        continue;
+      }
+      ChatClient* client = reinterpret_cast<ChatClient*>(tag & ~kClientWakeBit);
+      if (std::find(detached.begin(), detached.end(), client) != detached.end()) {
+        continue;
+      }
+      bool hangup = false;
+      if (tag & kClientWakeBit) {
+        eventfd_t wakeups = 0;
+        eventfd_read(client->wake_fd_, &wakeups);
+      } else {
+        hangup = (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0;
+      }
+      client->Service(hangup);
+    }
+
+    // Detach returns only after the batch, which may still name the client.
+    if (drained != 0) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        completed_ = drained;
+      }
+      changed_.notify_all();
+    }
+  }
+
+  // Stopped: finish pending detaches so nobody waits forever.
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!mailbox_.empty()) {
+    std::vector<Request> requests;
+    requests.swap(mailbox_);
+    lock.unlock();
+    for (const Request& request : requests) {
+      if (request.command == Command::kInstall) {
+        close(request.fd);
+      } else if (request.command == Command::kDetach) {
+        Unwatch(request.client);
+      }
+    }
+    lock.lock();
+  }
+  completed_ = submitted_;
+  lock.unlock();
+  changed_.notify_all();
+}
+
+uint64_t ChatClientPool::DrainMailbox(std::vector<ChatClient*>* detached) {
+  std::vector<Request> requests;
+  uint64_t drained = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    requests.swap(mailbox_);
+    drained = submitted_;
+  }
+  for (Request& request : requests) {
+    ChatClient* client = request.client;
+    switch (request.command) {
+      case Command::kAttach:
+        Watch(client);
+        break;
+      case Command::kInstall:
+        if (client->Adopt(request.fd, std::move(request.inbound))) {
+          add_to_epoll(epoll_fd_, client->sock_fd_, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+                       client_tag(client));
+          client->Service(false);
+        } else if (!client->stopping_.load()) {
+          Reconnect(client, request.delay_ms);
+        }
+        break;
+      case Command::kDetach:
+        Unwatch(client);
+        detached->push_back(client);
+        break;
+    }
+  }
+  return drained;
+}
+
+void ChatClientPool::Watch(ChatClient* client) {
+  add_to_epoll(epoll_fd_, client->wake_fd_, EPOLLIN | EPOLLET, client_tag(client) | kClientWakeBit);
+  if (client->sock_fd_ >= 0) {
+    add_to_epoll(epoll_fd_, client->sock_fd_, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+                 client_tag(client));
+  }
+  client->Service(false);
+}
+
+void ChatClientPool::Unwatch(ChatClient* client) {
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, client->wake_fd_, nullptr);
+  if (client->sock_fd_ >= 0) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, client->sock_fd_, nullptr);
+  }
+}
+
+void ChatClientPool::RunConnector() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (running_.load()) {
+    auto next = std::min_element(
+        retries_.begin(), retries_.end(),
+        [](const Retry& a, const Retry& b) { return a.due < b.due; });
+    if (next == retries_.end()) {
+      changed_.wait(lock);
+      continue;
+    }
+    if (next->due > std::chrono::steady_clock::now()) {
+      changed_.wait_until(lock, next->due);
+      continue;
+    }
+    Retry retry = *next;
+    retries_.erase(next);
+    connecting_ = retry.client;
+    lock.unlock();
+    std::string inbound;
+    int fd = retry.client->Open(false, &inbound);
+    lock.lock();
+    connecting_ = nullptr;
+    changed_.notify_all();
+
+    int delay_ms = std::min(retry.delay_ms * 2, retry.client->max_delay_ms_);
+    if (fd >= 0) {
+      // The I/O thread installs the socket; it owns the client's state.
+      mailbox_.push_back(Request{Command::kInstall, retry.client, fd, std::move(inbound), delay_ms});
+      ++submitted_;
+      eventfd_write(wake_fd_, 1);
+      continue;
+    }
+    std::uniform_int_distribution<int> jitter(delay_ms / 2, delay_ms);
+    retries_.push_back(Retry{retry.client,
+                             std::chrono::steady_clock::now() +
+                                 std::chrono::milliseconds(jitter(random_)),
+                             delay_ms});
+  }
+}
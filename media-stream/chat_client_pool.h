@@ -0,0 +1,96 @@
+#ifndef MEDIA_STREAM_CHAT_CLIENT_POOL_H_
+#define MEDIA_STREAM_CHAT_CLIENT_POOL_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ChatClient;
+
+// Runs the I/O of many ChatClients on one epoll thread instead of a thread
+// per client. Connecting blocks, so reconnect attempts happen on a second
+// thread, which hands each new socket to the I/O thread the way
+// PeerConnector hands relay links to reactors. A client joins by being
+// constructed with the pool and must be disconnected before the pool is
+// destroyed.
+class ChatClientPool {
+ public:
+  using Task = std::function<void()>;
+  // Receives one task per message, each owning a copy of the message, in
+  // arrival order per client; tasks must finish before their client is
+  // destroyed. Without one, callbacks run on the I/O thread, where they
+  // must not block or disconnect clients of the pool.
+  using Executor = std::function<void(Task)>;
+
+  explicit ChatClientPool(Executor executor = nullptr);
+  ~ChatClientPool();
+  ChatClientPool(const ChatClientPool&) = delete;
+  ChatClientPool& operator=(const ChatClientPool&) = delete;
+
+  bool Start();
+  void Stop();
+
+ private:
+  friend class ChatClient;
+
+  enum class Command {
+    kAttach,
+    kInstall,
+    kDetach,
+  };
+
+  struct Request {
+    Command command;
+    ChatClient* client;
+    int fd;
+    std::string inbound;
+    int delay_ms;
+  };
+
+  struct Retry {
+    ChatClient* client;
+    std::chrono::steady_clock::time_point due;
+    int delay_ms;
+  };
+
+  // Called by ChatClient. Attach starts watching a client (and its socket,
+  // if connected); Detach returns once the pool will not touch it again.
+  void Attach(ChatClient* client);
+  void Detach(ChatClient* client);
+  // Schedules a reconnect attempt after `delay_ms` (jittered); 0 means the
+  // client's initial delay.
+  void Reconnect(ChatClient* client, int delay_ms = 0);
+  void Submit(Request request);
+
+  void Run();
+  void RunConnector();
+  // Returns how many requests have been submitted, all of them now handled.
+  uint64_t DrainMailbox(std::vector<ChatClient*>* detached);
+  void Watch(ChatClient* client);
+  void Unwatch(ChatClient* client);
+
+  Executor executor_;
+  int epoll_fd_;
+  int wake_fd_;
+  std::atomic<bool> running_;
+  std::thread io_thread_;
+  std::thread connector_thread_;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::vector<Request> mailbox_;
+  uint64_t submitted_ = 0;
+  uint64_t completed_ = 0;
+  std::vector<Retry> retries_;
+  ChatClient* connecting_ = nullptr;
+  std::mt19937 random_;
+};
+
+#endif  // MEDIA_STREAM_CHAT_CLIENT_POOL_H_
@@ -1,33 +1,88 @@
 #include "chat_client.h"
 
 #include <iostream>
+#include <sstream>
 #include <string>
 
 int main(int argc, char* argv[]) {
   std::string server_ip = "127.0.0.1";
   int port = 54000;
 
-  if (argc > 1) {
-    server_ip = argv[1];
-  }
-  if (argc > 2) {
-    port = std::stoi(argv[2]);
+  WireFormat format = WireFormat::kText;
+  std::string name;
+  ClientRole role = ClientRole::kFollower;
+
+  int positional = 0;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--binary") {
+      format = WireFormat::kBinary;
+    } else if (arg == "--name" && i + 1 < argc) {
+      name = argv[++i];
+      if (!valid_client_name(name)) {
+        std::cerr << "Invalid client name: " << name << '\n';
+        return 1;
+      }
+    } else if (arg == "--role" && i + 1 < argc) {
+      std::string value = argv[++i];
+      if (!parse_client_role(value, &role)) {
+        std::cerr << "Unknown role: " << value << '\n';
+        return 1;
+      }
+    } else if (positional == 0) {
+      server_ip = arg;
+      ++positional;
+    } else if (positional == 1) {
+      port = std::stoi(arg);
+      ++positional;
+    }
   }
 
   ChatClient client;
+  client.SetWireFormat(format);
+  if (!name.empty()) {
+    client.SetIdentity(name, role);
+  }
   if (!client.Connect(server_ip, port)) {
     return 1;
   }
 
   std::cout << "Connected to " << server_ip << ":" << port << '\n';
   std::cout << "Type messages and press Enter. Type /quit to exit.\n";
-  client.StartReceiver();
+  std::cout << "Channels: /subscribe <name>, /unsubscribe <name>, /publish <name>\n";
+  std::cout << "History: /replay <name> seq <N>, /replay <name> since <unix_ms>\n";
+  client.StartLineReceiver([](std::string_view line) { std::cout << line << '\n' << std::flush; });
 
   std::string line;
-  while (client.IsConnected() && std::getline(std::cin, line)) {
+  while (std::getline(std::cin, line)) {
     if (line == "/quit") {
       break;
     }
+    std::string channel = line.substr(line.find(' ') + 1);
+    if (line.rfind("/subscribe ", 0) == 0) {
+      client.Subscribe(channel);
+      continue;
+    }
+    if (line.rfind("/unsubscribe ", 0) == 0) {
+      client.Unsubscribe(channel);
+      continue;
+    }
+    if (line.rfind("/publish ", 0) == 0) {
+      client.SetPublishChannel(channel);
+      continue;
+    }
+    if (line.rfind("/replay ", 0) == 0) {
+      std::istringstream args(channel);
+      std::string name;
+      std::string mode;
+      uint64_t start = 0;
+      if (!(args >> name >> mode >> start) || (mode != "seq" && mode != "since")) {
+        std::cerr << "Usage: /replay <name> seq <N> | /replay <name> since <unix_ms>\n";
+        continue;
+      }
+      client.Replay(name, mode == "seq" ? ReplayFrom::kSequence : ReplayFrom::kTime, start);
+      continue;
+    }
     if (!client.SendLine(line)) {
       std::cerr << "Send failed.\n";
       break;
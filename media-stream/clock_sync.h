@@ -0,0 +1,107 @@
+#ifndef MEDIA_STREAM_CLOCK_SYNC_H_
+#define MEDIA_STREAM_CLOCK_SYNC_H_
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Estimates the server's clock from kTimeSync exchanges, NTP style. Each
+// exchange yields an offset sample, server time minus the midpoint of the
+// local send and receive times, which is off by at most half the round trip.
+// The estimate uses the sample with the smallest round trip among the recent
+// ones, so queueing delays on either side are filtered out. The skew, the
+// rate at which the two clocks drift apart, is fitted over the best sample of
+// each past window and extrapolates the offset between exchanges.
+class ClockSync {
+ public:
+  // `send_ns` and `receive_ns` are on the local clock, `server_ns` on the
+  // server's.
+  void AddSample(int64_t send_ns, int64_t server_ns, int64_t receive_ns) {
+    if (receive_ns < send_ns) {
+      return;
+    }
+    Sample sample;
+    sample.local_ns = send_ns + (receive_ns - send_ns) / 2;
+    sample.offset_ns = server_ns - sample.local_ns;
+    sample.rtt_ns = receive_ns - send_ns;
+    recent_[recent_count_ % kWindow] = sample;
+    ++recent_count_;
+
+    best_ = recent_[0];
+    for (size_t i = 1; i < std::min(recent_count_, kWindow); ++i) {
+      if (recent_[i].rtt_ns < best_.rtt_ns) {
+        best_ = recent_[i];
+      }
+    }
+    if (recent_count_ % kWindow == 0) {
+      anchors_[anchor_count_ % kAnchors] = best_;
+      ++anchor_count_;
+      FitSkew();
+    }
+  }
+
+  bool Synced() const { return recent_count_ > 0; }
+
+  // Server time at local time `local_ns`. Only meaningful once Synced().
+  int64_t ToServer(int64_t local_ns) const { return local_ns + OffsetNs(local_ns); }
+
+  int64_t OffsetNs(int64_t local_ns) const {
+    double elapsed = static_cast<double>(local_ns - best_.local_ns);
+    return best_.offset_ns + static_cast<int64_t>(skew_ * elapsed);
+  }
+  // Server clock rate minus local clock rate, e.g. 1e-5 for 10 ppm.
+  double Skew() const { return skew_; }
+  // Round trip of the sample the offset is based on; twice the error bound.
+  int64_t RttNs() const { return best_.rtt_ns; }
+  size_t Samples() const { return recent_count_; }
+
+ private:
+  static constexpr size_t kWindow = 8;
+  static constexpr size_t kAnchors = 16;
+  // A skew fitted over a short span is mostly noise.
+  static constexpr int64_t kMinSkewSpanNs = 10000000000;
+  // Well beyond the drift of any working oscillator.
+  static constexpr double kMaxSkew = 500e-6;
+
+  struct Sample {
+    int64_t local_ns = 0;
+    int64_t offset_ns = 0;
+    int64_t rtt_ns = 0;
+  };
+
+  // Least squares of offset over local time, relative to the oldest anchor
+  // to keep the sums small.
+  void FitSkew() {
+    size_t count = std::min(anchor_count_, kAnchors);
+    const Sample& oldest = anchors_[anchor_count_ > kAnchors ? anchor_count_ % kAnchors : 0];
+    const Sample& newest = anchors_[(anchor_count_ - 1) % kAnchors];
+    if (count < 3 || newest.local_ns - oldest.local_ns < kMinSkewSpanNs) {
+      return;
+    }
+    double sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0;
+    for (size_t i = 0; i < count; ++i) {
+      double x = static_cast<double>(anchors_[i].local_ns - oldest.local_ns);
+      double y = static_cast<double>(anchors_[i].offset_ns - oldest.offset_ns);
+      sum_x += x;
+      sum_y += y;
+      sum_xx += x * x;
+      sum_xy += x * y;
+    }
+    double n = static_cast<double>(count);
+    double denominator = n * sum_xx - sum_x * sum_x;
+    if (denominator <= 0) {
+      return;
+    }
+    skew_ = std::clamp((n * sum_xy - sum_x * sum_y) / denominator, -kMaxSkew, kMaxSkew);
+  }
+
+  std::array<Sample, kWindow> recent_;
+  size_t recent_count_ = 0;
+  std::array<Sample, kAnchors> anchors_;
+  size_t anchor_count_ = 0;
+  Sample best_;
+  double skew_ = 0;
+};
+
+#endif  // MEDIA_STREAM_CLOCK_SYNC_H_
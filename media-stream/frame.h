@@ -0,0 +1,329 @@
+#ifndef MEDIA_STREAM_FRAME_H_
+#define MEDIA_STREAM_FRAME_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Binary framing shared by the server and ChatClient.
+//
+// A binary client opens the connection with an 8-byte hello:
+//   0x00 'M' 'S' 'F' <version> <flags> 0x00 0x00
+// The leading NUL can never start a text line, so the server tells the two
+// protocols apart from the first byte. The server answers with its own hello
+// carrying the accepted version; every byte after that is a stream of frames,
+// each a 16-byte big-endian header followed by the payload:
+//   u8 version | u8 type | u16 flags | u32 channel | u32 sender_id | u32 payload_size
+//
+// sender_id is the session handle the server assigned to the publisher. A
+// client that registers a name gets the same handle on every connection;
+// anonymous connections get a fresh one each time.
+
+enum class WireFormat : uint8_t {
+  kText,
+  kBinary,
+  // Binary framing between relay servers; see kFrameFlagRelayed.
+  kRelay,
+};
+
+enum class FrameType : uint8_t {
+  kData = 1,
+  kNotice = 2,
+  kStatus = 3,
+  kSubscribe = 4,
+  kUnsubscribe = 5,
+  // Client to server: u8 role followed by the client name, once per
+  // connection. Server to lobby: the same payload, with sender_id set to the
+  // handle the name was bound to.
+  kRegister = 6,
+  // Sent by a relay server right after its hello to turn the connection into
+  // a peer link. Payload: u32 server id.
+  kPeer = 7,
+  // Client to server: u8 ReplayFrom | u64 start | channel name. The server
+  // answers with the logged messages followed by a notice.
+  kReplay = 8,
+  // Server to publisher: subscribers of the frame's channel are falling
+  // behind. Payload: u32 messages queued for the slowest of them.
+  kBackpressure = 9,
+  // Client to server: i64 timestamp on the client's clock. The server answers
+  // on the same connection with that timestamp followed by i64 server time,
+  // Unix nanoseconds, read when it handled the request.
+  kTimeSync = 10,
+};
+
+enum class ReplayFrom : uint8_t {
+  kSequence = 0,
+  // Unix time in milliseconds.
+  kTime = 1,
+};
+
+// Every frame on a peer link carries this flag and prefixes the payload with
+// the message id assigned by the server it was first published on, plus the
+// sender prefix text clients see:
+//   u64 message_id | u16 prefix_size | prefix | payload
+// Relays drop ids they have already seen, so any peer topology is loop-free.
+constexpr uint16_t kFrameFlagRelayed = 0x0001;
+constexpr size_t kRelayHeaderSize = 10;
+
+enum class ClientRole : uint8_t {
+  kNone = 0,
+  kLeader = 1,
+  kFollower = 2,
+  kMonitor = 3,
+};
+
+constexpr uint8_t kFrameVersion = 1;
+constexpr size_t kHelloSize = 8;
+constexpr size_t kFrameHeaderSize = 16;
+constexpr uint32_t kMaxFramePayload = 1024 * 1024;
+// A relayed frame wraps a full-size payload in the relay header and prefix.
+constexpr uint32_t kMaxRelayFramePayload = kMaxFramePayload + kRelayHeaderSize + 0xFFFF;
+constexpr size_t kMaxChannelName = 128;
+constexpr size_t kMaxClientName = 64;
+
+// Every connection starts subscribed to and publishing on the lobby.
+constexpr std::string_view kLobbyChannelName = "lobby";
+constexpr uint32_t kLobbyChannel = 0;
+
+struct FrameHeader {
+  uint8_t version = kFrameVersion;
+  FrameType type = FrameType::kData;
+  uint16_t flags = 0;
+  uint32_t channel = 0;
+  uint32_t sender_id = 0;
+  uint32_t payload_size = 0;
+};
+
+struct FrameView {
+  FrameHeader header;
+  std::string_view payload;
+};
+
+inline void put_u16(uint8_t* out, uint16_t value) {
+  out[0] = static_cast<uint8_t>(value >> 8);
+  out[1] = static_cast<uint8_t>(value);
+}
+
+inline void put_u32(uint8_t* out, uint32_t value) {
+  out[0] = static_cast<uint8_t>(value >> 24);
+  out[1] = static_cast<uint8_t>(value >> 16);
+  out[2] = static_cast<uint8_t>(value >> 8);
+  out[3] = static_cast<uint8_t>(value);
+}
+
+inline uint16_t get_u16(const uint8_t* in) {
+  return static_cast<uint16_t>((in[0] << 8) | in[1]);
+}
+
+inline uint32_t get_u32(const uint8_t* in) {
+  return (static_cast<uint32_t>(in[0]) << 24) | (static_cast<uint32_t>(in[1]) << 16) |
+         (static_cast<uint32_t>(in[2]) << 8) | static_cast<uint32_t>(in[3]);
+}
+
+inline void put_u64(uint8_t* out, uint64_t value) {
+  put_u32(out, static_cast<uint32_t>(value >> 32));
+  put_u32(out + 4, static_cast<uint32_t>(value));
+}
+
+inline uint64_t get_u64(const uint8_t* in) {
+  return (static_cast<uint64_t>(get_u32(in)) << 32) | get_u32(in + 4);
+}
+
+// 32-bit FNV-1a, used wherever a name is reduced to a compact id.
+inline uint32_t hash_name(std::string_view name) {
+  uint32_t hash = 2166136261u;
+  for (char c : name) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// Channels are addressed by name in commands and by id in frames.
+inline uint32_t channel_id(std::string_view name) {
+  if (name == kLobbyChannelName) {
+    return kLobbyChannel;
+  }
+  uint32_t id = hash_name(name);
+  return id == kLobbyChannel ? 1 : id;
+}
+
+inline bool valid_channel_name(std::string_view name) {
+  return !name.empty() && name.size() <= kMaxChannelName &&
+         name.find_first_of(" \t\r\n") == std::string_view::npos;
+}
+
+inline const char* wire_format_name(WireFormat format) {
+  switch (format) {
+    case WireFormat::kBinary:
+      return "binary";
+    case WireFormat::kRelay:
+      return "relay";
+    case WireFormat::kText:
+      break;
+  }
+  return "text";
+}
+
+inline bool valid_client_name(std::string_view name) {
+  return !name.empty() && name.size() <= kMaxClientName &&
+         name.find_first_of(" \t\r\n:") == std::string_view::npos;
+}
+
+inline const char* client_role_name(ClientRole role) {
+  switch (role) {
+    case ClientRole::kLeader:
+      return "leader";
+    case ClientRole::kFollower:
+      return "follower";
+    case ClientRole::kMonitor:
+      return "monitor";
+    case ClientRole::kNone:
+      break;
+  }
+  return "none";
+}
+
+inline bool parse_client_role(std::string_view name, ClientRole* out) {
+  for (ClientRole role : {ClientRole::kLeader, ClientRole::kFollower, ClientRole::kMonitor}) {
+    if (name == client_role_name(role)) {
+      *out = role;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline std::string encode_register_payload(ClientRole role, std::string_view name) {
+  std::string payload(1, static_cast<char>(role));
+  payload.append(name);
+  return payload;
+}
+
+// Text rendering of a kRegister announcement.
+inline std::string registration_text(std::string_view name, ClientRole role) {
+  return std::string(name) + " registered as " + client_role_name(role) + ".";
+}
+
+// Returns false unless the payload carries a known role and a valid name.
+inline bool decode_register_payload(std::string_view payload, ClientRole* role,
+                                    std::string_view* name) {
+  if (payload.empty()) {
+    return false;
+  }
+  uint8_t value = static_cast<uint8_t>(payload[0]);
+  if (value < static_cast<uint8_t>(ClientRole::kLeader) ||
+      value > static_cast<uint8_t>(ClientRole::kMonitor)) {
+    return false;
+  }
+  *role = static_cast<ClientRole>(value);
+  *name = payload.substr(1);
+  return valid_client_name(*name);
+}
+
+inline std::string encode_backpressure_payload(uint32_t depth) {
+  std::string payload(4, '\0');
+  put_u32(reinterpret_cast<uint8_t*>(&payload[0]), depth);
+  return payload;
+}
+
+inline bool decode_backpressure_payload(std::string_view payload, uint32_t* depth) {
+  if (payload.size() != 4) {
+    return false;
+  }
+  *depth = get_u32(reinterpret_cast<const uint8_t*>(payload.data()));
+  return true;
+}
+
+// Text rendering of a kBackpressure signal.
+inline std::string backpressure_text(uint32_t depth) {
+  return "Subscribers are falling behind (" + std::to_string(depth) +
+         " messages queued); slow down.";
+}
+
+constexpr size_t kTimeSyncRequestSize = 8;
+constexpr size_t kTimeSyncReplySize = 16;
+
+inline std::string encode_time_sync_request(int64_t client_ns) {
+  std::string payload(kTimeSyncRequestSize, '\0');
+  put_u64(reinterpret_cast<uint8_t*>(&payload[0]), static_cast<uint64_t>(client_ns));
+  return payload;
+}
+
+inline bool decode_time_sync_request(std::string_view payload, int64_t* client_ns) {
+  if (payload.size() != kTimeSyncRequestSize) {
+    return false;
+  }
+  *client_ns = static_cast<int64_t>(get_u64(reinterpret_cast<const uint8_t*>(payload.data())));
+  return true;
+}
+
+inline std::string encode_time_sync_reply(int64_t client_ns, int64_t server_ns) {
+  std::string payload(kTimeSyncReplySize, '\0');
+  uint8_t* out = reinterpret_cast<uint8_t*>(&payload[0]);
+  put_u64(out, static_cast<uint64_t>(client_ns));
+  put_u64(out + 8, static_cast<uint64_t>(server_ns));
+  return payload;
+}
+
+inline bool decode_time_sync_reply(std::string_view payload, int64_t* client_ns,
+                                   int64_t* server_ns) {
+  if (payload.size() != kTimeSyncReplySize) {
+    return false;
+  }
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(payload.data());
+  *client_ns = static_cast<int64_t>(get_u64(in));
+  *server_ns = static_cast<int64_t>(get_u64(in + 8));
+  return true;
+}
+
+// Text rendering of a kTimeSync reply, also the answer to `/time <client_ns>`.
+inline std::string time_sync_text(int64_t client_ns, int64_t server_ns) {
+  return "[TIME_SYNC] client_ns=" + std::to_string(client_ns) +
+         " server_ns=" + std::to_string(server_ns);
+}
+
+inline void encode_hello(uint8_t version, uint8_t* out) {
+  out[0] = 0x00;
+  out[1] = 'M';
+  out[2] = 'S';
+  out[3] = 'F';
+  out[4] = version;
+  out[5] = 0;
+  out[6] = 0;
+  out[7] = 0;
+}
+
+// Returns false if the bytes are not a hello.
+inline bool decode_hello(const uint8_t* in, uint8_t* version) {
+  if (in[0] != 0x00 || in[1] != 'M' || in[2] != 'S' || in[3] != 'F') {
+    return false;
+  }
+  *version = in[4];
+  return true;
+}
+
+inline void encode_frame_header(const FrameHeader& header, uint8_t* out) {
+  out[0] = header.version;
+  out[1] = static_cast<uint8_t>(header.type);
+  put_u16(out + 2, header.flags);
+  put_u32(out + 4, header.channel);
+  put_u32(out + 8, header.sender_id);
+  put_u32(out + 12, header.payload_size);
+}
+
+// Returns false for an unsupported version or a payload over `max_payload`;
+// either means the stream can no longer be trusted.
+inline bool decode_frame_header(const uint8_t* in, FrameHeader* out,
+                                uint32_t max_payload = kMaxFramePayload) {
+  out->version = in[0];
+  out->type = static_cast<FrameType>(in[1]);
+  out->flags = get_u16(in + 2);
+  out->channel = get_u32(in + 4);
+  out->sender_id = get_u32(in + 8);
+  out->payload_size = get_u32(in + 12);
+  return out->version == kFrameVersion && out->payload_size <= max_payload;
+}
+
+#endif  // MEDIA_STREAM_FRAME_H_
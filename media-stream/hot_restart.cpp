@@ -0,0 +1,626 @@
+#include "hot_restart.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+#include <unordered_set>
+
+#include "peer_connector.h"
+#include "reactor.h"
+
+namespace {
+constexpr uint32_t kHandoffMagic = 0x4d534852;  // "MSHR"
+constexpr size_t kHandoffHeaderSize = 16;
+// SCM_MAX_FD is 253.
+constexpr size_t kMaxFdsPerMessage = 250;
+// How long the new process may take to set up before the old one resumes.
+constexpr int kCommitTimeoutSeconds = 10;
+constexpr char kCommitByte = 'C';
+// Where a taking-over process binds its own hot restart socket until the old
+// one has let go of the path.
+constexpr char kPendingSuffix[] = ".takeover";
+// The old process's answer to kCommitByte: it will not touch a socket again.
+constexpr char kCommitAckByte = 'A';
+
+int64_t steady_now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void append_u8(std::string* out, uint8_t value) { out->push_back(static_cast<char>(value)); }
+
+void append_u32(std::string* out, uint32_t value) {
+  uint8_t bytes[4];
+  put_u32(bytes, value);
+  out->append(reinterpret_cast<char*>(bytes), sizeof(bytes));
+}
+
+void append_u64(std::string* out, uint64_t value) {
+  uint8_t bytes[8];
+  put_u64(bytes, value);
+  out->append(reinterpret_cast<char*>(bytes), sizeof(bytes));
+}
+
+void append_bytes(std::string* out, std::string_view bytes) {
+  append_u32(out, static_cast<uint32_t>(bytes.size()));
+  out->append(bytes);
+}
+
+// Reads the encoding above; any read past the end clears `ok` and yields 0.
+struct Reader {
+  std::string_view data;
+  bool ok = true;
+
+  const uint8_t* Take(size_t size) {
+    if (!ok || data.size() < size) {
+      ok = false;
+      return nullptr;
+    }
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+    data.remove_prefix(size);
+    return bytes;
+  }
+  uint8_t U8() {
+    const uint8_t* bytes = Take(1);
+    return bytes ? bytes[0] : 0;
+  }
+  uint32_t U32() {
+    const uint8_t* bytes = Take(4);
+    return bytes ? get_u32(bytes) : 0;
+  }
+  uint64_t U64() {
+    const uint8_t* bytes = Take(8);
+    return bytes ? get_u64(bytes) : 0;
+  }
+  std::string Bytes() {
+    uint32_t size = U32();
+    const uint8_t* bytes = Take(size);
+    return bytes ? std::string(reinterpret_cast<const char*>(bytes), size) : std::string();
+  }
+};
+
+// Layout, after the header (u32 magic | u32 descriptor count | u64 size):
+//   u32 server_id | u32 next_message_seq | u64 next_client_id | u32 port | u32 listeners |
+//   u32 stats port, 0 without a stats listener
+//   u32 count, sessions:    u32 handle | u8 role | u64 connection_id | name
+//   u32 count, statuses:    u8 type | u32 channel | u32 sender | u64 id | prefix | payload | text
+//   u32 count, connections: u32 reactor | u64 id | u32 handle | u8 role | u8 registered |
+//                           u8 format | u8 negotiated | label | prefix | u32 count, channels |
+//                           u32 publish_channel | inbound | outbound | u64 x5 counters
+// where strings are a u32 size and the bytes. Descriptors are the listeners,
+// the stats listener if any, then the connections, in order.
+std::string encode_state(const HandoffState& state) {
+  std::string out;
+  append_u32(&out, state.server_id);
+  append_u32(&out, state.next_message_seq);
+  append_u64(&out, state.next_client_id);
+  append_u32(&out, static_cast<uint32_t>(state.port));
+  append_u32(&out, static_cast<uint32_t>(state.listeners.size()));
+  append_u32(&out, state.stats_listener >= 0 ? static_cast<uint32_t>(state.stats_port) : 0);
+
+  append_u32(&out, static_cast<uint32_t>(state.sessions.size()));
+  for (const Session& session : state.sessions) {
+    append_u32(&out, session.handle);
+    append_u8(&out, static_cast<uint8_t>(session.role));
+    append_u64(&out, session.connection_id);
+    append_bytes(&out, session.name);
+  }
+
+  append_u32(&out, static_cast<uint32_t>(state.last_status.size()));
+  for (const MessageRef& message : state.last_status) {
+    append_u8(&out, static_cast<uint8_t>(message->type()));
+    append_u32(&out, message->channel());
+    append_u32(&out, message->sender_id());
+    append_u64(&out, message->id());
+    append_bytes(&out, message->prefix());
+    append_bytes(&out, message->payload());
+    // Empty unless the message carries a separate text rendering.
+    bool has_text = message->text_payload().data() != message->payload().data();
+    append_bytes(&out, has_text ? message->text_payload() : std::string_view());
+  }
+
+  append_u32(&out, static_cast<uint32_t>(state.connections.size()));
+  for (const HandoffConnection& conn : state.connections) {
+    append_u32(&out, static_cast<uint32_t>(conn.reactor));
+    append_u64(&out, conn.id);
+    append_u32(&out, conn.handle);
+    append_u8(&out, static_cast<uint8_t>(conn.role));
+    append_u8(&out, conn.registered ? 1 : 0);
+    append_u8(&out, static_cast<uint8_t>(conn.format));
+    append_u8(&out, conn.negotiated ? 1 : 0);
+    append_bytes(&out, conn.label);
+    append_bytes(&out, conn.prefix);
+    append_u32(&out, static_cast<uint32_t>(conn.channels.size()));
+    for (uint32_t channel : conn.channels) {
+      append_u32(&out, channel);
+    }
+    append_u32(&out, conn.publish_channel);
+    append_bytes(&out, conn.inbound);
+    append_bytes(&out, conn.outbound);
+    append_u64(&out, conn.rate_limited);
+    append_u64(&out, conn.messages_in);
+    append_u64(&out, conn.bytes_in);
+    append_u64(&out, conn.messages_out);
+    append_u64(&out, conn.bytes_out);
+  }
+  return out;
+}
+
+bool decode_state(std::string_view data, const std::vector<int>& fds, HandoffState* state) {
+  Reader in{data};
+  state->server_id = in.U32();
+  state->next_message_seq = in.U32();
+  state->next_client_id = in.U64();
+  state->port = static_cast<int>(in.U32());
+  uint32_t listeners = in.U32();
+  state->stats_port = static_cast<int>(in.U32());
+  size_t inherited = listeners + (state->stats_port != 0 ? 1 : 0);
+  if (!in.ok || listeners == 0 || inherited > fds.size()) {
+    return false;
+  }
+  state->listeners.assign(fds.begin(), fds.begin() + listeners);
+  if (state->stats_port != 0) {
+    state->stats_listener = fds[listeners];
+  }
+
+  uint32_t sessions = in.U32();
+  for (uint32_t i = 0; i < sessions && in.ok; ++i) {
+    Session session;
+    session.handle = in.U32();
+    session.role = static_cast<ClientRole>(in.U8());
+    session.connection_id = in.U64();
+    session.name = in.Bytes();
+    state->sessions.push_back(std::move(session));
+  }
+
+  uint32_t statuses = in.U32();
+  for (uint32_t i = 0; i < statuses && in.ok; ++i) {
+    FrameType type = static_cast<FrameType>(in.U8());
+    uint32_t channel = in.U32();
+    uint32_t sender = in.U32();
+    uint64_t id = in.U64();
+    std::string prefix = in.Bytes();
+    std::string payload = in.Bytes();
+    std::string text = in.Bytes();
+    if (in.ok) {
+      state->last_status.push_back(
+          Message::Create(type, channel, sender, prefix, payload, text, id));
+    }
+  }
+
+  uint32_t connections = in.U32();
+  if (!in.ok || inherited + connections != fds.size()) {
+    return false;
+  }
+  for (uint32_t i = 0; i < connections && in.ok; ++i) {
+    HandoffConnection conn;
+    conn.fd = fds[inherited + i];
+    conn.reactor = static_cast<int>(in.U32());
+    conn.id = in.U64();
+    conn.handle = in.U32();
+    conn.role = static_cast<ClientRole>(in.U8());
+    conn.registered = in.U8() != 0;
+    conn.format = static_cast<WireFormat>(in.U8());
+    conn.negotiated = in.U8() != 0;
+    conn.label = in.Bytes();
+    conn.prefix = in.Bytes();
+    uint32_t channels = in.U32();
+    for (uint32_t c = 0; c < channels && in.ok; ++c) {
+      conn.channels.push_back(in.U32());
+    }
+    conn.publish_channel = in.U32();
+    conn.inbound = in.Bytes();
+    conn.outbound = in.Bytes();
+    conn.rate_limited = in.U64();
+    conn.messages_in = in.U64();
+    conn.bytes_in = in.U64();
+    conn.messages_out = in.U64();
+    conn.bytes_out = in.U64();
+    if (conn.reactor < 0 || static_cast<uint32_t>(conn.reactor) >= listeners) {
+      return false;
+    }
+    state->connections.push_back(std::move(conn));
+  }
+  return in.ok && in.data.empty();
+}
+
+bool send_all(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return false;
+    }
+    data += sent;
+    size -= static_cast<size_t>(sent);
+  }
+  return true;
+}
+
+bool recv_all(int fd, char* data, size_t size) {
+  while (size > 0) {
+    ssize_t received = recv(fd, data, size, 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      return false;
+    }
+    data += received;
+    size -= static_cast<size_t>(received);
+  }
+  return true;
+}
+
+// Each batch of descriptors rides on a single byte so that the receiver
+// reads exactly one batch per recvmsg.
+bool send_fds(int fd, const std::vector<int>& fds) {
+  for (size_t first = 0; first < fds.size(); first += kMaxFdsPerMessage) {
+    size_t count = std::min(kMaxFdsPerMessage, fds.size() - first);
+    char byte = 0;
+    iovec iov{&byte, 1};
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * count));
+    msghdr header{};
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    header.msg_control = control.data();
+    header.msg_controllen = control.size();
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    std::memcpy(CMSG_DATA(cmsg), fds.data() + first, sizeof(int) * count);
+    ssize_t sent;
+    do {
+      sent = sendmsg(fd, &header, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent != 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool recv_fds(int fd, size_t count, std::vector<int>* fds) {
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * kMaxFdsPerMessage));
+  while (fds->size() < count) {
+    char byte;
+    iovec iov{&byte, 1};
+    msghdr header{};
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    header.msg_control = control.data();
+    header.msg_controllen = control.size();
+    ssize_t received = recvmsg(fd, &header, MSG_CMSG_CLOEXEC);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received != 1 || (header.msg_flags & MSG_CTRUNC)) {
+      return false;
+    }
+    size_t before = fds->size();
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&header); cmsg; cmsg = CMSG_NXTHDR(&header, cmsg)) {
+      if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        continue;
+      }
+      size_t received_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      const unsigned char* data = CMSG_DATA(cmsg);
+      for (size_t i = 0; i < received_fds; ++i) {
+        int received_fd;
+        std::memcpy(&received_fd, data + i * sizeof(int), sizeof(int));
+        fds->push_back(received_fd);
+      }
+    }
+    if (fds->size() == before) {
+      return false;
+    }
+  }
+  return fds->size() == count;
+}
+
+bool unix_address(const std::string& path, sockaddr_un* address) {
+  *address = sockaddr_un{};
+  address->sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(address->sun_path)) {
+    std::cerr << "Invalid hot restart socket path: " << path << '\n';
+    return false;
+  }
+  std::memcpy(address->sun_path, path.c_str(), path.size() + 1);
+  return true;
+}
+
+int local_port(int fd) {
+  sockaddr_in address{};
+  socklen_t size = sizeof(address);
+  if (getsockname(fd, reinterpret_cast<sockaddr*>(&address), &size) != 0) {
+    return 0;
+  }
+  return ntohs(address.sin_port);
+}
+}  // namespace
+
+HotRestart::HotRestart(ServerContext* context)
+    : context_(context), wake_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+
+HotRestart::~HotRestart() {
+  Stop();
+  if (listen_fd_ >= 0) close(listen_fd_);
+  if (wake_fd_ >= 0) close(wake_fd_);
+  if (link_ >= 0) close(link_);
+  if (!bound_path_.empty() && bound_path_ != path_) {
+    unlink(bound_path_.c_str());
+  }
+}
+
+bool HotRestart::Listen(const std::string& path, bool takeover) {
+  std::string bind_path = takeover ? path + kPendingSuffix : path;
+  sockaddr_un address;
+  if (!unix_address(bind_path, &address)) {
+    return false;
+  }
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0 || wake_fd_ < 0) {
+    std::cerr << "Hot restart socket creation failed.\n";
+    return false;
+  }
+  unlink(bind_path.c_str());
+  if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+      listen(listen_fd_, 1) < 0) {
+    std::cerr << "Failed to listen on hot restart socket " << bind_path << '\n';
+    return false;
+  }
+  path_ = path;
+  bound_path_ = bind_path;
+  return true;
+}
+
+bool HotRestart::Publish() {
+  if (bound_path_ == path_) {
+    return true;
+  }
+  if (rename(bound_path_.c_str(), path_.c_str()) != 0) {
+    std::cerr << "Failed to move the hot restart socket to " << path_ << '\n';
+    return false;
+  }
+  bound_path_ = path_;
+  return true;
+}
+
+void HotRestart::Start() {
+  if (listen_fd_ < 0) {
+    return;
+  }
+  running_ = true;
+  thread_ = std::thread(&HotRestart::Run, this);
+}
+
+void HotRestart::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = false;
+  }
+  if (wake_fd_ >= 0) {
+    uint64_t one = 1;
+    ssize_t ignored = write(wake_fd_, &one, sizeof(one));
+    (void)ignored;
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void HotRestart::Run() {
+  pollfd fds[2] = {{listen_fd_, POLLIN, 0}, {wake_fd_, POLLIN, 0}};
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!running_) {
+        return;
+      }
+    }
+    if (poll(fds, 2, -1) < 0 || !(fds[0].revents & POLLIN)) {
+      continue;
+    }
+    int link = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (link < 0) {
+      continue;
+    }
+    ucred peer{};
+    socklen_t size = sizeof(peer);
+    if (getsockopt(link, SOL_SOCKET, SO_PEERCRED, &peer, &size) != 0 || peer.uid != geteuid()) {
+      std::cerr << "Refusing hot restart from another user.\n";
+      close(link);
+      continue;
+    }
+    if (HandOff(link)) {
+      link_ = link;
+      return;
+    }
+    close(link);
+  }
+}
+
+bool HotRestart::HandOff(int link) {
+  std::cout << "Handing over to a new server process...\n";
+  if (context_->peer_connector) {
+    // Relay links are not handed over; the new process opens its own.
+    context_->peer_connector->Stop();
+  }
+  size_t reactors = context_->reactors.size();
+  std::unique_lock<std::mutex> lock(mutex_);
+  ++round_;
+  quiesced_ = 0;
+  submitted_ = 0;
+  listeners_.assign(reactors, -1);
+  stats_listener_ = -1;
+  connections_.clear();
+  lock.unlock();
+  for (Reactor* reactor : context_->reactors) {
+    reactor->BeginHandoff();
+  }
+  lock.lock();
+  changed_.wait(lock, [&] { return submitted_ == reactors; });
+
+  HandoffState state;
+  state.server_id = context_->server_id;
+  state.next_message_seq = context_->next_message_seq.load();
+  state.next_client_id = context_->next_client_id.load();
+  state.port = local_port(listeners_.front());
+  state.listeners = listeners_;
+  state.stats_listener = stats_listener_;
+  state.stats_port = stats_listener_ >= 0 ? local_port(stats_listener_) : 0;
+  state.sessions = context_->sessions.Snapshot();
+  state.last_status = context_->last_status.Snapshot(steady_now_ns());
+  state.connections = std::move(connections_);
+  std::vector<int> fds = state.listeners;
+  if (state.stats_listener >= 0) {
+    fds.push_back(state.stats_listener);
+  }
+  for (const HandoffConnection& conn : state.connections) {
+    fds.push_back(conn.fd);
+  }
+  std::string body = encode_state(state);
+  uint8_t header[kHandoffHeaderSize];
+  put_u32(header, kHandoffMagic);
+  put_u32(header + 4, static_cast<uint32_t>(fds.size()));
+  put_u64(header + 8, body.size());
+
+  timeval timeout{};
+  timeout.tv_sec = kCommitTimeoutSeconds;
+  setsockopt(link, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  char reply = 0;
+  // Without the ack the new process exits, so a commit that arrives after the
+  // timeout, once this process has resumed, cannot leave both serving.
+  char ack = kCommitAckByte;
+  bool committed = send_all(link, reinterpret_cast<char*>(header), sizeof(header)) &&
+                   send_fds(link, fds) && send_all(link, body.data(), body.size()) &&
+                   recv_all(link, &reply, 1) && reply == kCommitByte && send_all(link, &ack, 1);
+  if (committed) {
+    std::cout << "Handed over " << state.connections.size()
+              << " connection(s); exiting.\n";
+    unlink(path_.c_str());
+  } else {
+    std::cerr << "Hot restart failed; resuming.\n";
+  }
+  decided_round_ = round_;
+  committed_ = committed;
+  lock.unlock();
+  changed_.notify_all();
+  if (!committed && context_->peer_connector) {
+    context_->peer_connector->Start();
+  }
+  return committed;
+}
+
+void HotRestart::WaitForQuiesce() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  ++quiesced_;
+  changed_.notify_all();
+  changed_.wait(lock, [&] { return quiesced_ == context_->reactors.size(); });
+}
+
+bool HotRestart::Submit(int reactor, int listen_fd, int stats_fd,
+                        std::vector<HandoffConnection> connections) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  uint64_t round = round_;
+  listeners_[reactor] = listen_fd;
+  if (stats_fd >= 0) {
+    stats_listener_ = stats_fd;
+  }
+  for (HandoffConnection& conn : connections) {
+    conn.reactor = reactor;
+    connections_.push_back(std::move(conn));
+  }
+  ++submitted_;
+  changed_.notify_all();
+  changed_.wait(lock, [&] { return decided_round_ == round; });
+  return committed_;
+}
+
+int HotRestart::Receive(const std::string& path, HandoffState* state) {
+  sockaddr_un address;
+  if (!unix_address(path, &address)) {
+    return -1;
+  }
+  int link = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (link < 0 || connect(link, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+    std::cerr << "No server to take over at " << path << '\n';
+    if (link >= 0) close(link);
+    return -1;
+  }
+
+  uint8_t header[kHandoffHeaderSize];
+  std::vector<int> fds;
+  std::string body;
+  bool ok = recv_all(link, reinterpret_cast<char*>(header), sizeof(header)) &&
+            get_u32(header) == kHandoffMagic;
+  if (ok) {
+    body.resize(get_u64(header + 8));
+    ok = recv_fds(link, get_u32(header + 4), &fds) && recv_all(link, body.data(), body.size()) &&
+         decode_state(body, fds, state);
+  }
+  if (!ok) {
+    std::cerr << "Hot restart handoff from " << path << " failed.\n";
+    for (int fd : fds) {
+      close(fd);
+    }
+    close(link);
+    return -1;
+  }
+  return link;
+}
+
+void HotRestart::RestoreContext(const HandoffState& state, ServerContext* context) {
+  context->server_id = state.server_id;
+  context->next_message_seq.store(state.next_message_seq);
+  context->next_client_id.store(state.next_client_id);
+  // Sessions bound to a connection that was not handed over (a closing one)
+  // come back offline.
+  std::unordered_set<uint64_t> connections;
+  for (const HandoffConnection& conn : state.connections) {
+    connections.insert(conn.id);
+  }
+  std::vector<Session> sessions = state.sessions;
+  for (Session& session : sessions) {
+    if (connections.count(session.connection_id) == 0) {
+      session.connection_id = 0;
+    }
+  }
+  context->sessions.Restore(sessions);
+  int64_t now_ns = steady_now_ns();
+  for (const MessageRef& message : state.last_status) {
+    context->last_status.Store(message->channel(), message, now_ns);
+  }
+}
+
+bool HotRestart::Commit(int link) {
+  char byte = kCommitByte;
+  bool acked = send_all(link, &byte, 1) && recv_all(link, &byte, 1) && byte == kCommitAckByte;
+  if (acked) {
+    // Returns once the old process has exited and closed its end.
+    ssize_t received;
+    do {
+      received = recv(link, &byte, 1, 0);
+    } while (received > 0 || (received < 0 && errno == EINTR));
+  } else {
+    std::cerr << "The previous server process did not confirm the takeover.\n";
+  }
+  close(link);
+  return acked;
+}
@@ -0,0 +1,127 @@
+#ifndef MEDIA_STREAM_HOT_RESTART_H_
+#define MEDIA_STREAM_HOT_RESTART_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame.h"
+#include "message.h"
+#include "session_registry.h"
+
+struct ServerContext;
+
+// One client connection as handed to the next server process.
+struct HandoffConnection {
+  int fd = -1;
+  int reactor = 0;
+  uint64_t id = 0;
+  uint32_t handle = 0;
+  ClientRole role = ClientRole::kNone;
+  bool registered = false;
+  WireFormat format = WireFormat::kText;
+  bool negotiated = false;
+  std::string label;
+  std::string prefix;
+  std::vector<uint32_t> channels;
+  uint32_t publish_channel = kLobbyChannel;
+  // Bytes received but not parsed yet, and encoded bytes not written yet.
+  std::string inbound;
+  std::string outbound;
+  uint64_t rate_limited = 0;
+  uint64_t messages_in = 0;
+  uint64_t bytes_in = 0;
+  uint64_t messages_out = 0;
+  uint64_t bytes_out = 0;
+};
+
+// Everything a server process hands over on a hot restart. The listeners
+// (one per reactor) and connection sockets travel as SCM_RIGHTS descriptors.
+struct HandoffState {
+  uint32_t server_id = 0;
+  uint32_t next_message_seq = 1;
+  uint64_t next_client_id = 1;
+  int port = 0;
+  std::vector<int> listeners;
+  // Handed over too: a listener closed by an io_uring process may linger
+  // until its ring is torn down, so rebinding the port could fail.
+  int stats_listener = -1;
+  int stats_port = 0;
+  std::vector<Session> sessions;
+  std::vector<MessageRef> last_status;
+  std::vector<HandoffConnection> connections;
+};
+
+// Hot restart over a Unix socket. The running server listens on the socket;
+// a new process started with --takeover connects, and the running server
+// stops every reactor between two events, sends its listeners, client
+// sockets and session state, and exits once the new process confirms. Clients
+// see a pause, never a disconnect. If the new process fails before
+// confirming, the running server resumes where it stopped.
+class HotRestart {
+ public:
+  explicit HotRestart(ServerContext* context);
+  ~HotRestart();
+  HotRestart(const HotRestart&) = delete;
+  HotRestart& operator=(const HotRestart&) = delete;
+
+  // Serves takeovers on `path`, replacing a stale socket file. A process that
+  // is taking over binds next to `path`, which the old one still serves, and
+  // moves its socket into place with Publish once the old one has exited.
+  bool Listen(const std::string& path, bool takeover = false);
+  bool Publish();
+  void Start();
+  void Stop();
+
+  // Called on each reactor's thread once it stopped all I/O: blocks until
+  // every reactor has.
+  void WaitForQuiesce();
+  // Called on each reactor's thread with its state: blocks until the new
+  // process confirmed (true, the reactor must exit without touching its
+  // sockets again) or the takeover failed (false, the reactor resumes).
+  bool Submit(int reactor, int listen_fd, int stats_fd,
+              std::vector<HandoffConnection> connections);
+
+  // New process: connects to the server listening on `path` and receives its
+  // state. Returns the link to that server, which stays stopped until Commit
+  // or until the link closes, or -1.
+  static int Receive(const std::string& path, HandoffState* state);
+  // New process: adopts the shared state that is not tied to a reactor.
+  static void RestoreContext(const HandoffState& state, ServerContext* context);
+  // New process: tells the old server to exit and waits until it has.
+  // Returns false if the old server did not confirm, in which case it may
+  // still be serving and no handed-over socket may be touched.
+  static bool Commit(int link);
+
+ private:
+  void Run();
+  bool HandOff(int link);
+
+  ServerContext* context_;
+  std::string path_;
+  // Differs from path_ until a takeover has been published.
+  std::string bound_path_;
+  int listen_fd_ = -1;
+  int wake_fd_ = -1;
+  // Held open after a commit: the new process waits for it to close, which
+  // happens only once this process has exited.
+  int link_ = -1;
+  bool running_ = false;
+  std::thread thread_;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  uint64_t round_ = 0;
+  uint64_t decided_round_ = 0;
+  bool committed_ = false;
+  size_t quiesced_ = 0;
+  size_t submitted_ = 0;
+  std::vector<int> listeners_;
+  int stats_listener_ = -1;
+  std::vector<HandoffConnection> connections_;
+};
+
+#endif  // MEDIA_STREAM_HOT_RESTART_H_
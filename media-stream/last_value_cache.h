@@ -0,0 +1,83 @@
+#ifndef MEDIA_STREAM_LAST_VALUE_CACHE_H_
+#define MEDIA_STREAM_LAST_VALUE_CACHE_H_
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "message.h"
+
+// Most recent [VIDEO_STATUS] message per channel, shared by all reactors so a
+// late subscriber can be synced without waiting for the next periodic update.
+// Players send a status every second; one that has not been refreshed for a
+// few intervals belongs to a player that is gone, and replaying it would make
+// a new follower extrapolate from a stale playhead.
+class LastValueCache {
+ public:
+  static constexpr int64_t kMaxAgeNs = 3000000000;
+
+  // `now_ns` is on the steady clock.
+  void Store(uint32_t channel, const MessageRef& message, int64_t now_ns) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    latest_[channel] = Entry{message, now_ns};
+  }
+
+  // The channel's status, unless it has expired.
+  MessageRef Lookup(uint32_t channel, int64_t now_ns) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = latest_.find(channel);
+    if (it == latest_.end()) {
+      return MessageRef();
+    }
+    if (now_ns - it->second.stored_ns > kMaxAgeNs) {
+      latest_.erase(it);
+      return MessageRef();
+    }
+    return it->second.message;
+  }
+
+  // Forgets the channel's status if `sender_id` published it.
+  void Evict(uint32_t channel, uint32_t sender_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = latest_.find(channel);
+    if (it != latest_.end() && it->second.message->sender_id() == sender_id) {
+      latest_.erase(it);
+    }
+  }
+
+  // Forgets every status `sender_id` published, e.g. when it disconnects.
+  void EvictSender(uint32_t sender_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = latest_.begin(); it != latest_.end();) {
+      if (it->second.message->sender_id() == sender_id) {
+        it = latest_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  std::vector<MessageRef> Snapshot(int64_t now_ns) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<MessageRef> messages;
+    messages.reserve(latest_.size());
+    for (const auto& entry : latest_) {
+      if (now_ns - entry.second.stored_ns <= kMaxAgeNs) {
+        messages.push_back(entry.second.message);
+      }
+    }
+    return messages;
+  }
+
+ private:
+  struct Entry {
+    MessageRef message;
+    int64_t stored_ns;
+  };
+
+  mutable std::mutex mutex_;
+  std::unordered_map<uint32_t, Entry> latest_;
+};
+
+#endif  // MEDIA_STREAM_LAST_VALUE_CACHE_H_
@@ -0,0 +1,59 @@
+#ifndef MEDIA_STREAM_LATENCY_HISTOGRAM_H_
+#define MEDIA_STREAM_LATENCY_HISTOGRAM_H_
+
+#include <atomic>
+#include <cstdint>
+
+// Log2-bucketed latency histogram in microseconds. Bucket 0 counts samples
+// under 1us and bucket i counts [2^(i-1), 2^i) us. Recording is lock-free.
+class LatencyHistogram {
+ public:
+  static constexpr int kBuckets = 32;
+
+  void Record(int64_t nanos) {
+    uint64_t micros = nanos > 0 ? static_cast<uint64_t>(nanos) / 1000 : 0;
+    int bucket = 0;
+    while (micros > 0 && bucket < kBuckets - 1) {
+      micros >>= 1;
+      ++bucket;
+    }
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  uint64_t BucketCount(int bucket) const {
+    return buckets_[bucket].load(std::memory_order_relaxed);
+  }
+
+  // Exclusive upper bound of a bucket in microseconds.
+  static uint64_t BucketLimitMicros(int bucket) { return uint64_t{1} << bucket; }
+
+  uint64_t Count() const {
+    uint64_t total = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+      total += BucketCount(i);
+    }
+    return total;
+  }
+
+  // Upper bound of the bucket holding quantile q (0..1), in microseconds.
+  uint64_t PercentileMicros(double q) const {
+    uint64_t total = Count();
+    if (total == 0) {
+      return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(total - 1)) + 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+      seen += BucketCount(i);
+      if (seen >= rank) {
+        return BucketLimitMicros(i);
+      }
+    }
+    return BucketLimitMicros(kBuckets - 1);
+  }
+
+ private:
+  std::atomic<uint64_t> buckets_[kBuckets] = {};
+};
+
+#endif  // MEDIA_STREAM_LATENCY_HISTOGRAM_H_
@@ -0,0 +1,137 @@
+#include "message.h"
+
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <utility>
+
+namespace {
+constexpr std::string_view kNewline = "\n";
+}  // namespace
+
+Message::Message(FrameType type, uint32_t channel, uint32_t sender_id, uint64_t id,
+                 uint32_t prefix_size, uint32_t payload_size, uint32_t text_size, bool raw)
+    : refs_(1),
+      type_(type),
+      raw_(raw),
+      channel_(channel),
+      sender_id_(sender_id),
+      id_(id),
+      prefix_size_(prefix_size),
+      payload_size_(payload_size),
+      text_size_(text_size),
+      created_ns_(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count()) {}
+
+MessageRef Message::Create(FrameType type, uint32_t channel, uint32_t sender_id,
+                           std::string_view prefix, std::string_view payload,
+                           std::string_view text_payload, uint64_t id) {
+  return Build(type, channel, sender_id, id, prefix, payload, text_payload, false);
+}
+
+MessageRef Message::CreateRaw(std::string_view bytes) {
+  return Build(FrameType::kNotice, 0, 0, 0, {}, bytes, {}, true);
+}
+
+MessageRef Message::Build(FrameType type, uint32_t channel, uint32_t sender_id, uint64_t id,
+                          std::string_view prefix, std::string_view payload,
+                          std::string_view text_payload, bool raw) {
+  void* storage = ::operator new(sizeof(Message) + kBodyOffset + prefix.size() + payload.size() +
+                                 text_payload.size());
+  Message* message = new (storage)
+      Message(type, channel, sender_id, id, static_cast<uint32_t>(prefix.size()),
+              static_cast<uint32_t>(payload.size()), static_cast<uint32_t>(text_payload.size()),
+              raw);
+
+  FrameHeader header;
+  header.type = type;
+  header.channel = channel;
+  header.sender_id = sender_id;
+  header.payload_size = static_cast<uint32_t>(payload.size());
+  uint8_t* bytes = reinterpret_cast<uint8_t*>(message->data());
+  encode_frame_header(header, bytes);
+
+  header.flags = kFrameFlagRelayed;
+  header.payload_size =
+      static_cast<uint32_t>(kRelayHeaderSize + prefix.size() + payload.size());
+  encode_frame_header(header, bytes + kRelayOffset);
+  put_u64(bytes + kRelayOffset + kFrameHeaderSize, id);
+  put_u16(bytes + kRelayOffset + kFrameHeaderSize + 8, static_cast<uint16_t>(prefix.size()));
+
+  char* cursor = message->data() + kBodyOffset;
+  if (!prefix.empty()) {
+    std::memcpy(cursor, prefix.data(), prefix.size());
+  }
+  if (!payload.empty()) {
+    std::memcpy(cursor + prefix.size(), payload.data(), payload.size());
+  }
+  if (!text_payload.empty()) {
+    std::memcpy(cursor + prefix.size() + payload.size(), text_payload.data(), text_payload.size());
+  }
+  return MessageRef(message);
+}
+
+size_t Message::size(WireFormat format) const {
+  if (raw_) {
+    return payload_size_;
+  }
+  if (format == WireFormat::kBinary) {
+    return kFrameHeaderSize + payload_size_;
+  }
+  if (format == WireFormat::kRelay) {
+    return kBodyOffset - kRelayOffset + prefix_size_ + payload_size_;
+  }
+  return prefix_size_ + text_payload().size() + kNewline.size();
+}
+
+int Message::FillIov(WireFormat format, size_t skip, iovec* iov, int max_iov) const {
+  std::string_view segments[3];
+  int segment_count = 0;
+  if (raw_) {
+    segments[segment_count++] = payload();
+  } else if (format == WireFormat::kBinary) {
+    segments[segment_count++] = {data(), kFrameHeaderSize};
+    segments[segment_count++] = payload();
+  } else if (format == WireFormat::kRelay) {
+    // Relay header, prefix and payload are contiguous.
+    segments[segment_count++] = {data() + kRelayOffset,
+                                 kBodyOffset - kRelayOffset + prefix_size_ + payload_size_};
+  } else {
+    segments[segment_count++] = prefix();
+    segments[segment_count++] = text_payload();
+    segments[segment_count++] = kNewline;
+  }
+
+  int count = 0;
+  for (int i = 0; i < segment_count && count < max_iov; ++i) {
+    std::string_view segment = segments[i];
+    if (skip >= segment.size()) {
+      skip -= segment.size();
+      continue;
+    }
+    iov[count].iov_base = const_cast<char*>(segment.data() + skip);
+    iov[count].iov_len = segment.size() - skip;
+    skip = 0;
+    ++count;
+  }
+  return count;
+}
+
+MessageRef::MessageRef(const MessageRef& other) : message_(other.message_) {
+  if (message_) {
+    message_->refs_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+MessageRef& MessageRef::operator=(MessageRef other) noexcept {
+  std::swap(message_, other.message_);
+  return *this;
+}
+
+MessageRef::~MessageRef() {
+  if (message_ && message_->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    message_->~Message();
+    ::operator delete(message_);
+  }
+}
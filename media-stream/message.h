@@ -0,0 +1,105 @@
+#ifndef MEDIA_STREAM_MESSAGE_H_
+#define MEDIA_STREAM_MESSAGE_H_
+
+#include <sys/uio.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "frame.h"
+
+class MessageRef;
+
+// Immutable relay message. The frame header, the text sender prefix and the
+// payload live in a single refcounted allocation and are written as separate
+// iovecs, so one message can be queued on any number of text or binary
+// connections without copying. Binary-only payloads (status records) carry a
+// text rendering alongside for text-protocol recipients. Messages with a
+// non-zero id also carry the header used to forward them to relay peers.
+class Message {
+ public:
+  static MessageRef Create(FrameType type, uint32_t channel, uint32_t sender_id,
+                           std::string_view prefix, std::string_view payload,
+                           std::string_view text_payload = {}, uint64_t id = 0);
+  // Bytes written verbatim regardless of the recipient's wire format.
+  static MessageRef CreateRaw(std::string_view bytes);
+
+  FrameType type() const { return type_; }
+  uint32_t channel() const { return channel_; }
+  uint32_t sender_id() const { return sender_id_; }
+  // Mesh-wide id assigned by the server the message was published on; 0 for
+  // messages that never leave this server.
+  uint64_t id() const { return id_; }
+  // steady_clock time at which the server built the message.
+  int64_t created_ns() const { return created_ns_; }
+  std::string_view prefix() const { return {data() + kBodyOffset, prefix_size_}; }
+  std::string_view payload() const {
+    return {data() + kBodyOffset + prefix_size_, payload_size_};
+  }
+  // Payload as seen by text-protocol recipients.
+  std::string_view text_payload() const {
+    if (text_size_ == 0) {
+      return payload();
+    }
+    return {data() + kBodyOffset + prefix_size_ + payload_size_, text_size_};
+  }
+
+  size_t size(WireFormat format) const;
+
+  // Fills up to max_iov iovecs with the encoded bytes after the first `skip`
+  // bytes. Returns the number of iovecs written.
+  int FillIov(WireFormat format, size_t skip, iovec* iov, int max_iov) const;
+
+ private:
+  friend class MessageRef;
+
+  // Allocation layout: binary frame header, relay frame header, prefix,
+  // payload, text payload.
+  static constexpr size_t kRelayOffset = kFrameHeaderSize;
+  static constexpr size_t kBodyOffset = kRelayOffset + kFrameHeaderSize + kRelayHeaderSize;
+
+  Message(FrameType type, uint32_t channel, uint32_t sender_id, uint64_t id,
+          uint32_t prefix_size, uint32_t payload_size, uint32_t text_size, bool raw);
+  static MessageRef Build(FrameType type, uint32_t channel, uint32_t sender_id, uint64_t id,
+                          std::string_view prefix, std::string_view payload,
+                          std::string_view text_payload, bool raw);
+
+  const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+  char* data() { return reinterpret_cast<char*>(this + 1); }
+
+  mutable std::atomic<uint32_t> refs_;
+  FrameType type_;
+  bool raw_;
+  uint32_t channel_;
+  uint32_t sender_id_;
+  uint64_t id_;
+  uint32_t prefix_size_;
+  uint32_t payload_size_;
+  uint32_t text_size_;
+  int64_t created_ns_;
+};
+
+class MessageRef {
+ public:
+  MessageRef() : message_(nullptr) {}
+  MessageRef(const MessageRef& other);
+  MessageRef(MessageRef&& other) noexcept : message_(other.message_) { other.message_ = nullptr; }
+  MessageRef& operator=(MessageRef other) noexcept;
+  ~MessageRef();
+
+  const Message* get() const { return message_; }
+  const Message* operator->() const { return message_; }
+  const Message& operator*() const { return *message_; }
+  explicit operator bool() const { return message_ != nullptr; }
+
+ private:
+  friend class Message;
+
+  explicit MessageRef(Message* message) : message_(message) {}
+
+  Message* message_;
+};
+
+#endif  // MEDIA_STREAM_MESSAGE_H_
@@ -0,0 +1,439 @@
+#include "message_log.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <utility>
+
+#include "status_record.h"
+
+namespace {
+constexpr size_t kRecordHeaderSize = 20;
+constexpr size_t kIndexEntrySize = 16;
+// Index capacity per segment, assuming records of at least this size.
+constexpr size_t kMinRecordBytes = 64;
+
+int64_t unix_now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// Read-only view of a whole file; empty if it could not be mapped.
+struct MappedFile {
+  const char* data = nullptr;
+  size_t size = 0;
+
+  explicit MappedFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return;
+    }
+    struct stat info {};
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+      size = static_cast<size_t>(info.st_size);
+      void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+      if (mapped != MAP_FAILED) {
+        data = static_cast<const char*>(mapped);
+      } else {
+        size = 0;
+      }
+    }
+    close(fd);
+  }
+  ~MappedFile() {
+    if (data) munmap(const_cast<char*>(data), size);
+  }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+};
+
+// Creates `path` at `size` bytes and maps it read-write.
+char* map_new_file(const std::string& path, size_t size) {
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return nullptr;
+  }
+  void* mapped = MAP_FAILED;
+  if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+    mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  return mapped == MAP_FAILED ? nullptr : static_cast<char*>(mapped);
+}
+
+int64_t entry_time(const char* index, uint64_t entry) {
+  return static_cast<int64_t>(
+      get_u64(reinterpret_cast<const uint8_t*>(index + entry * kIndexEntrySize)));
+}
+
+// Entries are zero past the last record of a segment that was not closed.
+uint64_t count_entries(const char* index, size_t size) {
+  uint64_t count = size / kIndexEntrySize;
+  uint64_t used = 0;
+  while (used < count && entry_time(index, used) != 0) {
+    ++used;
+  }
+  return used;
+}
+
+MessageRef decode_record(const char* record, size_t size, uint32_t channel) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(record);
+  if (size < kRecordHeaderSize || get_u32(bytes) != size) {
+    return MessageRef();
+  }
+  FrameType type = static_cast<FrameType>(bytes[4]);
+  size_t prefix_size = get_u16(bytes + 6);
+  uint32_t sender_id = get_u32(bytes + 8);
+  if (size - kRecordHeaderSize < prefix_size) {
+    return MessageRef();
+  }
+  std::string_view prefix(record + kRecordHeaderSize, prefix_size);
+  std::string_view payload(record + kRecordHeaderSize + prefix_size,
+                           size - kRecordHeaderSize - prefix_size);
+
+  std::string text;
+  StatusRecord status;
+  ClientRole role;
+  std::string_view name;
+  if (type == FrameType::kStatus && decode_status_record(payload, &status)) {
+    text = format_status_text(status);
+  } else if (type == FrameType::kRegister && decode_register_payload(payload, &role, &name)) {
+    text = registration_text(name, role);
+  }
+  // Replays are for one client only and never relayed, hence no id.
+  return Message::Create(type, channel, sender_id, prefix, payload, text);
+}
+}  // namespace
+
+MessageLog::MessageLog(std::string directory, size_t segment_bytes)
+    : directory_(std::move(directory)), segment_bytes_(segment_bytes) {}
+
+MessageLog::~MessageLog() { Stop(); }
+
+bool MessageLog::Start() {
+  if (mkdir(directory_.c_str(), 0755) != 0 && errno != EEXIST) {
+    std::cerr << "Cannot create log directory " << directory_ << '\n';
+    return false;
+  }
+  if (!Recover()) {
+    return false;
+  }
+  running_ = true;
+  thread_ = std::thread(&MessageLog::Run, this);
+  return true;
+}
+
+void MessageLog::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_) {
+      return;
+    }
+    running_ = false;
+  }
+  wake_.notify_one();
+  thread_.join();
+  for (auto& entry : channels_) {
+    CloseSegment(entry.second);
+  }
+}
+
+void MessageLog::Append(const MessageRef& message) {
+  int64_t now = unix_now_ns();
+  bool was_empty;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    was_empty = appends_.empty();
+    appends_.push_back({message, now});
+  }
+  // While the log thread is busy the queue is non-empty and it will pick
+  // this append up with the rest of the batch.
+  if (was_empty) {
+    wake_.notify_one();
+  }
+}
+
+void MessageLog::Replay(const ReplayRequest& request, ReplayCallback done) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    replays_.push_back({request, std::move(done)});
+  }
+  wake_.notify_one();
+}
+
+void MessageLog::Run() {
+  std::vector<PendingAppend> appends;
+  std::vector<PendingReplay> replays;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    wake_.wait(lock, [this] { return !running_ || !appends_.empty() || !replays_.empty(); });
+    bool running = running_;
+    appends.swap(appends_);
+    replays.swap(replays_);
+    lock.unlock();
+
+    for (const PendingAppend& append : appends) {
+      Write(append);
+    }
+    appends.clear();
+    for (PendingReplay& replay : replays) {
+      replay.done(Read(replay.request));
+    }
+    replays.clear();
+
+    lock.lock();
+    if (!running) {
+      return;
+    }
+  }
+}
+
+bool MessageLog::Recover() {
+  DIR* root = opendir(directory_.c_str());
+  if (!root) {
+    std::cerr << "Cannot read log directory " << directory_ << '\n';
+    return false;
+  }
+  while (dirent* channel_entry = readdir(root)) {
+    uint32_t channel_id = 0;
+    char extra = 0;
+    if (std::strlen(channel_entry->d_name) != 8 ||
+        std::sscanf(channel_entry->d_name, "%8" SCNx32 "%c", &channel_id, &extra) != 1) {
+      continue;
+    }
+    std::string channel_path = ChannelDirectory(channel_id);
+    DIR* channel_dir = opendir(channel_path.c_str());
+    if (!channel_dir) {
+      continue;
+    }
+    Channel& channel = channels_[channel_id];
+    while (dirent* segment_entry = readdir(channel_dir)) {
+      uint64_t first_seq = 0;
+      char suffix[8] = {};
+      if (std::strlen(segment_entry->d_name) != 24 ||
+          std::sscanf(segment_entry->d_name, "%20" SCNu64 ".%7s", &first_seq, suffix) != 2 ||
+          std::strcmp(suffix, "idx") != 0) {
+        continue;
+      }
+      Segment segment;
+      segment.first_seq = first_seq;
+      segment.path = channel_path + '/' + std::string(segment_entry->d_name, 20);
+      MappedFile index(segment.path + ".idx");
+      segment.count = count_entries(index.data, index.size);
+      if (segment.count == 0) {
+        continue;
+      }
+      segment.first_ns = entry_time(index.data, 0);
+      segment.last_ns = entry_time(index.data, segment.count - 1);
+      channel.segments.push_back(std::move(segment));
+    }
+    closedir(channel_dir);
+    std::sort(channel.segments.begin(), channel.segments.end(),
+              [](const Segment& a, const Segment& b) { return a.first_seq < b.first_seq; });
+    if (!channel.segments.empty()) {
+      channel.next_seq = channel.segments.back().first_seq + channel.segments.back().count;
+    }
+  }
+  closedir(root);
+  return true;
+}
+
+void MessageLog::Write(const PendingAppend& append) {
+  const Message& message = *append.message;
+  size_t size = kRecordHeaderSize + message.prefix().size() + message.payload().size();
+  if (size > segment_bytes_) {
+    return;
+  }
+  Channel& channel = channels_[message.channel()];
+  if (channel.log && (channel.log_used + size > segment_bytes_ ||
+                      channel.segments.back().count == channel.index_capacity)) {
+    CloseSegment(channel);
+  }
+  if (!channel.log && !OpenSegment(message.channel(), channel)) {
+    return;
+  }
+
+  Segment& segment = channel.segments.back();
+  uint8_t* record = reinterpret_cast<uint8_t*>(channel.log + channel.log_used);
+  put_u32(record, static_cast<uint32_t>(size));
+  record[4] = static_cast<uint8_t>(message.type());
+  record[5] = 0;
+  put_u16(record + 6, static_cast<uint16_t>(message.prefix().size()));
+  put_u32(record + 8, message.sender_id());
+  put_u64(record + 12, message.id());
+  std::memcpy(record + kRecordHeaderSize, message.prefix().data(), message.prefix().size());
+  std::memcpy(record + kRecordHeaderSize + message.prefix().size(), message.payload().data(),
+              message.payload().size());
+
+  uint8_t* entry = reinterpret_cast<uint8_t*>(channel.index + segment.count * kIndexEntrySize);
+  put_u64(entry, static_cast<uint64_t>(append.unix_ns));
+  put_u32(entry + 8, static_cast<uint32_t>(channel.log_used));
+  put_u32(entry + 12, static_cast<uint32_t>(size));
+
+  if (segment.count == 0) {
+    segment.first_ns = append.unix_ns;
+  }
+  segment.last_ns = append.unix_ns;
+  ++segment.count;
+  ++channel.next_seq;
+  channel.log_used += size;
+}
+
+bool MessageLog::OpenSegment(uint32_t channel_id, Channel& channel) {
+  std::string channel_path = ChannelDirectory(channel_id);
+  if (mkdir(channel_path.c_str(), 0755) != 0 && errno != EEXIST) {
+    std::cerr << "Cannot create log directory " << channel_path << '\n';
+    return false;
+  }
+  char name[32];
+  std::snprintf(name, sizeof(name), "%020" PRIu64, channel.next_seq);
+  Segment segment;
+  segment.first_seq = channel.next_seq;
+  segment.path = channel_path + '/' + name;
+
+  size_t index_capacity = segment_bytes_ / kMinRecordBytes;
+  channel.log = map_new_file(segment.path + ".log", segment_bytes_);
+  channel.index = map_new_file(segment.path + ".idx", index_capacity * kIndexEntrySize);
+  if (!channel.log || !channel.index) {
+    std::cerr << "Cannot create log segment " << segment.path << '\n';
+    if (channel.log) munmap(channel.log, segment_bytes_);
+    if (channel.index) munmap(channel.index, index_capacity * kIndexEntrySize);
+    channel.log = nullptr;
+    channel.index = nullptr;
+    return false;
+  }
+  channel.log_used = 0;
+  channel.index_capacity = index_capacity;
+  channel.segments.push_back(std::move(segment));
+  return true;
+}
+
+void MessageLog::CloseSegment(Channel& channel) {
+  if (!channel.log) {
+    return;
+  }
+  const Segment& segment = channel.segments.back();
+  munmap(channel.log, segment_bytes_);
+  munmap(channel.index, channel.index_capacity * kIndexEntrySize);
+  channel.log = nullptr;
+  channel.index = nullptr;
+  // Trim the preallocated tail so closed segments hold only records.
+  if (truncate((segment.path + ".log").c_str(), static_cast<off_t>(channel.log_used)) != 0 ||
+      truncate((segment.path + ".idx").c_str(),
+               static_cast<off_t>(segment.count * kIndexEntrySize)) != 0) {
+    std::cerr << "Cannot trim log segment " << segment.path << '\n';
+  }
+}
+
+MessageLog::ReplayResult MessageLog::Read(const ReplayRequest& request) {
+  ReplayResult result;
+  auto it = channels_.find(request.channel);
+  if (it == channels_.end() || it->second.segments.empty()) {
+    return result;
+  }
+  Channel& channel = it->second;
+  const std::vector<Segment>& segments = channel.segments;
+
+  // First segment that can hold the starting point.
+  size_t segment_index = 0;
+  if (request.by_time) {
+    int64_t from_ns = static_cast<int64_t>(request.from) * 1000000;
+    while (segment_index < segments.size() && segments[segment_index].last_ns < from_ns) {
+      ++segment_index;
+    }
+  } else {
+    while (segment_index < segments.size() &&
+           segments[segment_index].first_seq + segments[segment_index].count <= request.from) {
+      ++segment_index;
+    }
+  }
+
+  uint64_t seq = channel.next_seq;
+  size_t bytes = 0;
+  bool first = true;
+  for (; segment_index < segments.size(); ++segment_index) {
+    const Segment& segment = segments[segment_index];
+    // The active segment is read through the writer's own mapping; this
+    // thread is the only one touching it.
+    std::optional<MappedFile> log_file;
+    std::optional<MappedFile> index_file;
+    const char* log = channel.log;
+    const char* index = channel.index;
+    size_t log_size = segment_bytes_;
+    if (!channel.log || segment_index + 1 != segments.size()) {
+      log_file.emplace(segment.path + ".log");
+      index_file.emplace(segment.path + ".idx");
+      log = log_file->data;
+      index = index_file->data;
+      log_size = log_file->size;
+      if (!log || index_file->size < segment.count * kIndexEntrySize) {
+        continue;
+      }
+    }
+
+    uint64_t entry = 0;
+    if (first) {
+      if (request.by_time) {
+        int64_t from_ns = static_cast<int64_t>(request.from) * 1000000;
+        uint64_t low = 0;
+        uint64_t high = segment.count;
+        while (low < high) {
+          uint64_t mid = low + (high - low) / 2;
+          if (entry_time(index, mid) < from_ns) {
+            low = mid + 1;
+          } else {
+            high = mid;
+          }
+        }
+        entry = low;
+      } else if (request.from > segment.first_seq) {
+        entry = request.from - segment.first_seq;
+      }
+      result.first_seq = segment.first_seq + entry;
+      first = false;
+    }
+
+    for (; entry < segment.count; ++entry) {
+      const uint8_t* fields = reinterpret_cast<const uint8_t*>(index + entry * kIndexEntrySize);
+      uint32_t offset = get_u32(fields + 8);
+      uint32_t size = get_u32(fields + 12);
+      if (!result.messages.empty() &&
+          (result.messages.size() >= request.max_messages || bytes + size > request.max_bytes)) {
+        result.next_seq = segment.first_seq + entry;
+        return result;
+      }
+      if (static_cast<size_t>(offset) + size > log_size) {
+        continue;
+      }
+      MessageRef message = decode_record(log + offset, size, request.channel);
+      if (message) {
+        result.messages.push_back(std::move(message));
+        bytes += size;
+      }
+    }
+    seq = segment.first_seq + segment.count;
+  }
+  result.next_seq = seq;
+  if (first) {
+    result.first_seq = seq;
+  }
+  return result;
+}
+
+std::string MessageLog::ChannelDirectory(uint32_t channel) const {
+  char name[16];
+  std::snprintf(name, sizeof(name), "%08" PRIx32, channel);
+  return directory_ + '/' + name;
+}
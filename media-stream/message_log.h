@@ -0,0 +1,110 @@
+#ifndef MEDIA_STREAM_MESSAGE_LOG_H_
+#define MEDIA_STREAM_MESSAGE_LOG_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "message.h"
+
+// Append-only log of every message published on a channel, one directory
+// per channel holding memory-mapped segments:
+//   <dir>/<channel id, hex>/<first seq, 20 digits>.log   records
+//   <dir>/<channel id, hex>/<first seq, 20 digits>.idx   16 bytes per record
+// A record is
+//   u32 size | u8 type | u8 0 | u16 prefix_size | u32 sender_id | u64 message_id | prefix | payload
+// and an index entry is u64 unix_ns | u32 offset | u32 size, so the entry of
+// sequence number `seq` sits at (seq - first seq) * 16. All file I/O happens
+// on the log's own thread: Append only queues a reference to the message.
+class MessageLog {
+ public:
+  struct ReplayRequest {
+    uint32_t channel = 0;
+    // Start at this sequence number, or at the first message logged at or
+    // after this unix time in milliseconds.
+    bool by_time = false;
+    uint64_t from = 0;
+    size_t max_messages = 0;
+    size_t max_bytes = 0;
+  };
+
+  struct ReplayResult {
+    std::vector<MessageRef> messages;
+    uint64_t first_seq = 0;
+    // Sequence number to continue from; equals the log's next sequence
+    // number once everything has been replayed.
+    uint64_t next_seq = 0;
+  };
+
+  using ReplayCallback = std::function<void(ReplayResult)>;
+
+  MessageLog(std::string directory, size_t segment_bytes);
+  ~MessageLog();
+  MessageLog(const MessageLog&) = delete;
+  MessageLog& operator=(const MessageLog&) = delete;
+
+  // Recovers the segments already in the directory and starts the thread.
+  bool Start();
+  void Stop();
+
+  // Thread-safe and non-blocking apart from a short queue lock.
+  void Append(const MessageRef& message);
+  // Thread-safe: reads on the log thread, which then calls `done`.
+  void Replay(const ReplayRequest& request, ReplayCallback done);
+
+ private:
+  struct Segment {
+    uint64_t first_seq = 0;
+    uint64_t count = 0;
+    int64_t first_ns = 0;
+    int64_t last_ns = 0;
+    std::string path;  // Without extension.
+  };
+
+  struct Channel {
+    std::vector<Segment> segments;
+    uint64_t next_seq = 1;
+    // Active (last) segment, mapped read-write while it has room.
+    char* log = nullptr;
+    char* index = nullptr;
+    size_t log_used = 0;
+    size_t index_capacity = 0;
+  };
+
+  struct PendingAppend {
+    MessageRef message;
+    int64_t unix_ns;
+  };
+
+  struct PendingReplay {
+    ReplayRequest request;
+    ReplayCallback done;
+  };
+
+  void Run();
+  bool Recover();
+  void Write(const PendingAppend& append);
+  bool OpenSegment(uint32_t channel_id, Channel& channel);
+  void CloseSegment(Channel& channel);
+  ReplayResult Read(const ReplayRequest& request);
+  std::string ChannelDirectory(uint32_t channel) const;
+
+  const std::string directory_;
+  const size_t segment_bytes_;
+  std::map<uint32_t, Channel> channels_;
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool running_ = false;
+  std::vector<PendingAppend> appends_;
+  std::vector<PendingReplay> replays_;
+  std::thread thread_;
+};
+
+#endif  // MEDIA_STREAM_MESSAGE_LOG_H_
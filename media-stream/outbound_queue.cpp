@@ -0,0 +1,231 @@
+#include "outbound_queue.h"
+
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+
+bool parse_overflow_policy(const std::string& name, OverflowPolicy* out) {
+  if (name == "drop-oldest") {
+    *out = OverflowPolicy::kDropOldest;
+  } else if (name == "drop-newest") {
+    *out = OverflowPolicy::kDropNewest;
+  } else if (name == "disconnect") {
+    *out = OverflowPolicy::kDisconnect;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char* overflow_policy_name(OverflowPolicy policy) {
+  switch (policy) {
+    case OverflowPolicy::kDropOldest:
+      return "drop-oldest";
+    case OverflowPolicy::kDropNewest:
+      return "drop-newest";
+    case OverflowPolicy::kDisconnect:
+      return "disconnect";
+  }
+  return "unknown";
+}
+
+OutboundQueue::OutboundQueue(const OutboundLimits* limits)
+    : limits_(limits),
+      front_offset_(0),
+      pinned_(0),
+      bytes_(0),
+      dropped_(0),
+      conflated_(0),
+      next_seq_(0) {}
+
+bool OutboundQueue::Full(size_t incoming_bytes) const {
+  if (messages_.empty()) {
+    return false;
+  }
+  return messages_.size() + 1 > limits_->max_messages ||
+         bytes_ + incoming_bytes > limits_->max_bytes;
+}
+
+OutboundQueue::PushResult OutboundQueue::Push(MessageRef message, WireFormat format,
+                                              uint64_t conflation_key, bool timed) {
+  Entry entry{std::move(message), format, next_seq_, conflation_key, timed};
+  size_t entry_size = entry.size();
+  if (entry_size == 0) {
+    return PushResult::kQueued;
+  }
+  if (conflation_key != 0 && Conflate(entry)) {
+    ++conflated_;
+    return PushResult::kConflated;
+  }
+  if (Full(entry_size)) {
+    switch (limits_->policy) {
+      case OverflowPolicy::kDisconnect:
+        return PushResult::kOverflow;
+      case OverflowPolicy::kDropNewest:
+        ++dropped_;
+        return PushResult::kDropped;
+      case OverflowPolicy::kDropOldest: {
+        size_t keep = Locked();
+        while (messages_.size() > keep && Full(entry_size)) {
+          auto victim = messages_.begin() + static_cast<std::ptrdiff_t>(keep);
+          bytes_ -= victim->size();
+          Forget(*victim);
+          messages_.erase(victim);
+          ++dropped_;
+        }
+        if (Full(entry_size)) {
+          ++dropped_;
+          return PushResult::kDropped;
+        }
+        bytes_ += entry_size;
+        Append(std::move(entry));
+        return PushResult::kEvicted;
+      }
+    }
+  }
+  bytes_ += entry_size;
+  Append(std::move(entry));
+  return PushResult::kQueued;
+}
+
+void OutboundQueue::Append(Entry entry) {
+  ++next_seq_;
+  if (entry.conflation_key != 0) {
+    pending_keys_[entry.conflation_key] = entry.seq;
+  }
+  messages_.push_back(std::move(entry));
+}
+
+bool OutboundQueue::Conflate(Entry& entry) {
+  auto key = pending_keys_.find(entry.conflation_key);
+  if (key == pending_keys_.end()) {
+    return false;
+  }
+  // Entries are ordered by seq, so the superseded one is found by bisection
+  // even after evictions from the middle of the queue.
+  auto it = std::lower_bound(messages_.begin(), messages_.end(), key->second,
+                             [](const Entry& queued, uint64_t seq) { return queued.seq < seq; });
+  if (it == messages_.end() || it->seq != key->second) {
+    pending_keys_.erase(key);
+    return false;
+  }
+  if (static_cast<size_t>(it - messages_.begin()) < Locked()) {
+    return false;
+  }
+  // A larger replacement that would not fit goes through the overflow policy.
+  if (bytes_ - it->size() + entry.size() > limits_->max_bytes) {
+    return false;
+  }
+  bytes_ -= it->size();
+  bytes_ += entry.size();
+  it->message = std::move(entry.message);
+  it->format = entry.format;
+  it->timed = entry.timed;
+  return true;
+}
+
+void OutboundQueue::Forget(const Entry& entry) {
+  if (entry.conflation_key == 0) {
+    return;
+  }
+  auto key = pending_keys_.find(entry.conflation_key);
+  if (key != pending_keys_.end() && key->second == entry.seq) {
+    pending_keys_.erase(key);
+  }
+}
+
+int OutboundQueue::FillIov(iovec* iov, int max_iov, size_t* entries) const {
+  int iov_count = 0;
+  size_t skip = front_offset_;
+  *entries = 0;
+  for (const Entry& entry : messages_) {
+    if (iov_count == max_iov) {
+      break;
+    }
+    iov_count += entry.message->FillIov(entry.format, skip, iov + iov_count, max_iov - iov_count);
+    skip = 0;
+    ++*entries;
+  }
+  return iov_count;
+}
+
+void OutboundQueue::Consume(size_t sent, FlushStats* stats, LatencyHistogram* latency) {
+  bytes_ -= sent;
+  int64_t now_ns = 0;
+  if (latency) {
+    now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::steady_clock::now().time_since_epoch())
+                 .count();
+  }
+  if (stats) {
+    stats->bytes += sent;
+  }
+  while (sent > 0) {
+    size_t front_left = messages_.front().size() - front_offset_;
+    if (sent < front_left) {
+      front_offset_ += sent;
+      break;
+    }
+    sent -= front_left;
+    const Entry& done = messages_.front();
+    if (stats) {
+      ++stats->messages;
+    }
+    if (latency && done.timed) {
+      latency->Record(now_ns - done.message->created_ns());
+    }
+    Forget(done);
+    messages_.pop_front();
+    front_offset_ = 0;
+  }
+}
+
+bool OutboundQueue::Flush(int fd, FlushStats* stats, LatencyHistogram* latency) {
+  iovec iov[kMaxIov];
+  while (!messages_.empty()) {
+    size_t entries = 0;
+    int iov_count = FillIov(iov, kMaxIov, &entries);
+
+    msghdr header{};
+    header.msg_iov = iov;
+    header.msg_iovlen = static_cast<size_t>(iov_count);
+    ssize_t sent = sendmsg(fd, &header, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    Consume(static_cast<size_t>(sent), stats, latency);
+  }
+  return true;
+}
+
+int OutboundQueue::PrepareSend(iovec* iov, int max_iov) {
+  size_t entries = 0;
+  int iov_count = FillIov(iov, max_iov, &entries);
+  pinned_ = entries;
+  return iov_count;
+}
+
+void OutboundQueue::CompleteSend(size_t sent, FlushStats* stats, LatencyHistogram* latency) {
+  pinned_ = 0;
+  Consume(sent, stats, latency);
+}
+
+std::string OutboundQueue::Unsent() const {
+  std::string bytes;
+  bytes.reserve(bytes_);
+  size_t skip = front_offset_;
+  iovec iov[4];
+  for (const Entry& entry : messages_) {
+    int count = entry.message->FillIov(entry.format, skip, iov, 4);
+    for (int i = 0; i < count; ++i) {
+      bytes.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    }
+    skip = 0;
+  }
+  return bytes;
+}
@@ -0,0 +1,118 @@
+#ifndef MEDIA_STREAM_OUTBOUND_QUEUE_H_
+#define MEDIA_STREAM_OUTBOUND_QUEUE_H_
+
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+#include "latency_histogram.h"
+#include "message.h"
+
+enum class OverflowPolicy {
+  kDropOldest,
+  kDropNewest,
+  kDisconnect,
+};
+
+bool parse_overflow_policy(const std::string& name, OverflowPolicy* out);
+const char* overflow_policy_name(OverflowPolicy policy);
+
+struct FlushStats {
+  uint64_t messages = 0;
+  uint64_t bytes = 0;
+};
+
+struct OutboundLimits {
+  size_t max_messages = 1024;
+  size_t max_bytes = 4 * 1024 * 1024;
+  OverflowPolicy policy = OverflowPolicy::kDropOldest;
+};
+
+// Bounded per-connection queue of shared messages waiting for a writable
+// socket. The front message may be partially written; it is never dropped.
+class OutboundQueue {
+ public:
+  enum class PushResult {
+    kQueued,
+    kConflated,
+    // Queued after dropping older messages to make room.
+    kEvicted,
+    // The message itself was dropped.
+    kDropped,
+    kOverflow,
+  };
+
+  // Most iovecs handed to a single send.
+  static constexpr int kMaxIov = 64;
+
+  explicit OutboundQueue(const OutboundLimits* limits);
+
+  // `format` is the recipient's wire format at the time of queueing; a
+  // connection that switches protocol keeps earlier messages intact.
+  // A non-zero `conflation_key` replaces a queued-but-unsent message with the
+  // same key in place instead of appending, so a backlogged reader only ever
+  // sees the newest update per key, unless the replacement would overflow the
+  // queue. Untimed messages (replays of old state)
+  // are left out of the latency histogram passed to Flush.
+  PushResult Push(MessageRef message, WireFormat format, uint64_t conflation_key = 0,
+                  bool timed = true);
+
+  // Writes as much as the non-blocking socket accepts, batching queued
+  // messages into one sendmsg. Returns false on a socket error. Completed
+  // messages are added to `stats` and their age to `latency`, when given.
+  bool Flush(int fd, FlushStats* stats = nullptr, LatencyHistogram* latency = nullptr);
+
+  // Asynchronous sends (io_uring): PrepareSend fills `iov` with the unsent
+  // bytes of the front messages and pins them, so they are neither evicted
+  // nor conflated while the kernel may still read them. CompleteSend releases
+  // the pin once the send finished, having written `sent` bytes.
+  int PrepareSend(iovec* iov, int max_iov);
+  void CompleteSend(size_t sent, FlushStats* stats = nullptr, LatencyHistogram* latency = nullptr);
+
+  // Every byte still to be written, encoded for the formats it was queued in.
+  std::string Unsent() const;
+
+  bool empty() const { return messages_.empty(); }
+  size_t size() const { return messages_.size(); }
+  size_t bytes() const { return bytes_; }
+  uint64_t dropped() const { return dropped_; }
+  uint64_t conflated() const { return conflated_; }
+
+ private:
+  struct Entry {
+    MessageRef message;
+    WireFormat format;
+    uint64_t seq;
+    uint64_t conflation_key;
+    bool timed;
+    size_t size() const { return message->size(format); }
+  };
+
+  int FillIov(iovec* iov, int max_iov, size_t* entries) const;
+  void Consume(size_t sent, FlushStats* stats, LatencyHistogram* latency);
+  // Leading entries that must stay in place: a partially written front and
+  // anything pinned by an in-flight send.
+  size_t Locked() const { return std::max(pinned_, front_offset_ > 0 ? size_t{1} : size_t{0}); }
+  bool Full(size_t incoming_bytes) const;
+  void Append(Entry entry);
+  bool Conflate(Entry& entry);
+  void Forget(const Entry& entry);
+
+  const OutboundLimits* limits_;
+  std::deque<Entry> messages_;
+  size_t front_offset_;
+  size_t pinned_;
+  size_t bytes_;
+  uint64_t dropped_;
+  uint64_t conflated_;
+  uint64_t next_seq_;
+  // conflation key -> seq of the newest queued entry carrying it.
+  std::unordered_map<uint64_t, uint64_t> pending_keys_;
+};
+
+#endif  // MEDIA_STREAM_OUTBOUND_QUEUE_H_
@@ -0,0 +1,147 @@
+#include "peer_connector.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#include "reactor.h"
+
+namespace {
+constexpr auto kRetryInterval = std::chrono::seconds(1);
+constexpr int kConnectTimeoutSeconds = 1;
+
+void set_send_timeout(int fd, int seconds) {
+  timeval timeout{};
+  timeout.tv_sec = seconds;
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+}  // namespace
+
+PeerConnector::PeerConnector(ServerContext* context) : context_(context) {}
+
+PeerConnector::~PeerConnector() { Stop(); }
+
+bool PeerConnector::AddPeer(const std::string& address) {
+  size_t colon = address.rfind(':');
+  if (colon == std::string::npos || colon == 0 || colon + 1 == address.size()) {
+    return false;
+  }
+  auto peer = std::make_unique<Peer>();
+  peer->host = address.substr(0, colon);
+  std::string port = address.substr(colon + 1);
+  char* end = nullptr;
+  long value = std::strtol(port.c_str(), &end, 10);
+  if (*end != '\0' || value <= 0 || value > 65535) {
+    return false;
+  }
+  peer->port = static_cast<int>(value);
+  // A peer that does not resolve yet can still be dialled later; it just
+  // cannot dial us first.
+  AcceptFrom(peer->host);
+  peers_.push_back(std::move(peer));
+  return true;
+}
+
+bool PeerConnector::AcceptFrom(const std::string& host) {
+  addrinfo hints{};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* results = nullptr;
+  if (getaddrinfo(host.c_str(), nullptr, &hints, &results) != 0) {
+    return false;
+  }
+  for (addrinfo* it = results; it; it = it->ai_next) {
+    accepted_.insert(reinterpret_cast<const sockaddr_in*>(it->ai_addr)->sin_addr.s_addr);
+  }
+  freeaddrinfo(results);
+  return true;
+}
+
+void PeerConnector::Start() {
+  if (peers_.empty()) {
+    return;
+  }
+  running_ = true;
+  thread_ = std::thread(&PeerConnector::Run, this);
+}
+
+void PeerConnector::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = false;
+  }
+  wake_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void PeerConnector::Disconnected(int index) {
+  std::cerr << "Lost peer " << peers_[index]->host << ':' << peers_[index]->port << '\n';
+  peers_[index]->connected.store(false);
+  wake_.notify_all();
+}
+
+void PeerConnector::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (running_) {
+    lock.unlock();
+    for (size_t i = 0; i < peers_.size(); ++i) {
+      Peer& peer = *peers_[i];
+      if (peer.connected.load()) {
+        continue;
+      }
+      int fd = Connect(peer);
+      if (fd < 0) {
+        continue;
+      }
+      std::cout << "Connected to peer " << peer.host << ':' << peer.port << '\n';
+      peer.connected.store(true);
+      // Spread links over the reactors the way SO_REUSEPORT spreads clients.
+      Reactor* reactor = context_->reactors[i % context_->reactors.size()];
+      reactor->AdoptPeer(fd, static_cast<int>(i));
+    }
+    lock.lock();
+    wake_.wait_for(lock, kRetryInterval);
+  }
+}
+
+int PeerConnector::Connect(const Peer& peer) const {
+  addrinfo hints{};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* results = nullptr;
+  if (getaddrinfo(peer.host.c_str(), std::to_string(peer.port).c_str(), &hints, &results) != 0) {
+    return -1;
+  }
+
+  int fd = -1;
+  for (addrinfo* it = results; it; it = it->ai_next) {
+    fd = socket(it->ai_family, it->ai_socktype | SOCK_CLOEXEC, it->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    // SO_SNDTIMEO bounds a blocking connect.
+    set_send_timeout(fd, kConnectTimeoutSeconds);
+    if (connect(fd, it->ai_addr, it->ai_addrlen) == 0) {
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(results);
+  if (fd < 0) {
+    return -1;
+  }
+  set_send_timeout(fd, 0);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
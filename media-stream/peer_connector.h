@@ -0,0 +1,60 @@
+#ifndef MEDIA_STREAM_PEER_CONNECTOR_H_
+#define MEDIA_STREAM_PEER_CONNECTOR_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+struct ServerContext;
+
+// Keeps one outbound link open to every configured relay peer. Connecting
+// blocks, so it happens on this thread; each connected socket is handed to a
+// reactor, which owns it from then on and reports back when it closes.
+class PeerConnector {
+ public:
+  explicit PeerConnector(ServerContext* context);
+  ~PeerConnector();
+
+  // Accepts "host:port". Returns false if the address cannot be parsed.
+  bool AddPeer(const std::string& address);
+  bool empty() const { return peers_.empty(); }
+
+  // Inbound peer links are accepted only from the IPv4 addresses of the
+  // configured peers and of hosts added here. Returns false if `host` does
+  // not resolve. Call before the reactors start.
+  bool AcceptFrom(const std::string& host);
+  // `address` is in network byte order.
+  bool Accepts(uint32_t address) const { return accepted_.count(address) != 0; }
+
+  void Start();
+  void Stop();
+
+  // Thread-safe: the link to peer `index` closed; reconnect.
+  void Disconnected(int index);
+
+ private:
+  struct Peer {
+    std::string host;
+    int port = 0;
+    std::atomic<bool> connected{false};
+  };
+
+  void Run();
+  int Connect(const Peer& peer) const;
+
+  ServerContext* context_;
+  std::vector<std::unique_ptr<Peer>> peers_;
+  std::unordered_set<uint32_t> accepted_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool running_ = false;
+  std::thread thread_;
+};
+
+#endif  // MEDIA_STREAM_PEER_CONNECTOR_H_
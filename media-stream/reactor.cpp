@@ -0,0 +1,1447 @@
+#include "reactor.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <string_view>
+
+#include "hot_restart.h"
+#include "message_log.h"
+#include "peer_connector.h"
+#include "status_record.h"
+#include "uring.h"
+
+namespace {
+constexpr int kBufferSize = 16 * 1024;
+constexpr size_t kMaxTextLine = 64 * 1024;
+constexpr int kMaxEvents = 256;
+constexpr uint64_t kListenerTag = std::numeric_limits<uint64_t>::max();
+constexpr uint64_t kWakeTag = kListenerTag - 1;
+constexpr uint64_t kStatsTag = kListenerTag - 2;
+constexpr auto kTickInterval = std::chrono::seconds(1);
+// A stats reader has this long to take its report.
+constexpr auto kStatsReplyTimeout = std::chrono::seconds(5);
+constexpr int64_t kRateNoticeIntervalNs = 1000000000;
+constexpr int64_t kBackpressureIntervalNs = 1000000000;
+// Bounds how often one connection touches the shared channel state.
+constexpr int64_t kPressureCheckIntervalNs = 100000000;
+
+int64_t steady_now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int64_t unix_now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+bool is_status_message(FrameType type, std::string_view payload) {
+  if (type == FrameType::kStatus) {
+    return true;
+  }
+  return type == FrameType::kData &&
+         payload.compare(0, kStatusLinePrefix.size(), kStatusLinePrefix) == 0;
+}
+
+// A status saying its player stopped, which late subscribers must not sync to.
+bool ends_playback(const Message& message) {
+  if (message.type() == FrameType::kStatus) {
+    StatusRecord record;
+    return decode_status_record(message.payload(), &record) &&
+           (record.state == PlaybackState::kEof || record.state == PlaybackState::kClosed ||
+            record.eof());
+  }
+  std::string_view text = message.payload();
+  return text.find(" state=eof") != std::string_view::npos ||
+         text.find(" state=closed") != std::string_view::npos;
+}
+
+// Splits off the text up to the first space.
+std::string_view next_word(std::string_view* text) {
+  size_t space = text->find(' ');
+  std::string_view word = text->substr(0, space);
+  text->remove_prefix(space == std::string_view::npos ? text->size() : space + 1);
+  return word;
+}
+
+// epoll wants non-blocking sockets; io_uring parks a blocking send instead.
+void set_blocking(int fd, bool blocking) {
+  int flags = fcntl(fd, F_GETFL);
+  fcntl(fd, F_SETFL, blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK);
+}
+
+bool add_to_epoll(int epoll_fd, int fd, uint32_t events, uint64_t tag) {
+  epoll_event ev{};
+  ev.events = events;
+  ev.data.u64 = tag;
+  return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+}  // namespace
+
+bool parse_io_backend(const std::string& name, IoBackend* out) {
+  if (name == "epoll") {
+    *out = IoBackend::kEpoll;
+  } else if (name == "uring") {
+    *out = IoBackend::kUring;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+Reactor::Reactor(int index, ServerContext* context)
+    : index_(index),
+      context_(context),
+      epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+      listen_fd_(-1),
+      wake_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      stats_fd_(-1),
+      running_(false) {
+  if (epoll_fd_ >= 0 && wake_fd_ >= 0) {
+    add_to_epoll(epoll_fd_, wake_fd_, EPOLLIN | EPOLLET, kWakeTag);
+  }
+}
+
+Reactor::~Reactor() {
+  Stop();
+  Join();
+  for (auto& entry : connections_) {
+    close(entry.second.fd);
+  }
+  if (listen_fd_ >= 0) close(listen_fd_);
+  if (stats_fd_ >= 0) close(stats_fd_);
+  if (wake_fd_ >= 0) close(wake_fd_);
+  if (epoll_fd_ >= 0) close(epoll_fd_);
+}
+
+bool Reactor::Listen(int port, bool reuse_port) {
+  if (epoll_fd_ < 0 || wake_fd_ < 0) {
+    std::cerr << "Reactor " << index_ << ": epoll/eventfd creation failed.\n";
+    return false;
+  }
+
+  listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    std::cerr << "Socket creation failed.\n";
+    return false;
+  }
+
+  int opt = 1;
+  if (setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+    std::cerr << "setsockopt(SO_REUSEADDR) failed.\n";
+    return false;
+  }
+  if (reuse_port && setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+    std::cerr << "setsockopt(SO_REUSEPORT) failed.\n";
+    return false;
+  }
+
+  sockaddr_in server_addr{};
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_addr.s_addr = INADDR_ANY;
+  server_addr.sin_port = htons(static_cast<uint16_t>(port));
+
+  if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&server_addr), sizeof(server_addr)) < 0) {
+    std::cerr << "Bind failed on port " << port << ".\n";
+    return false;
+  }
+
+  if (listen(listen_fd_, SOMAXCONN) < 0) {
+    std::cerr << "Listen failed.\n";
+    return false;
+  }
+  return RegisterListener();
+}
+
+bool Reactor::AdoptListener(int fd) {
+  if (epoll_fd_ < 0 || wake_fd_ < 0) {
+    std::cerr << "Reactor " << index_ << ": epoll/eventfd creation failed.\n";
+    return false;
+  }
+  listen_fd_ = fd;
+  return RegisterListener();
+}
+
+bool Reactor::RegisterListener() {
+  if (context_->io_backend == IoBackend::kUring) {
+    return InitUring();
+  }
+  return add_to_epoll(epoll_fd_, listen_fd_, EPOLLIN | EPOLLET, kListenerTag);
+}
+
+bool Reactor::ListenStats(int port) {
+  stats_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (stats_fd_ < 0) {
+    std::cerr << "Stats socket creation failed.\n";
+    return false;
+  }
+
+  int opt = 1;
+  setsockopt(stats_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+  sockaddr_in stats_addr{};
+  stats_addr.sin_family = AF_INET;
+  stats_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  stats_addr.sin_port = htons(static_cast<uint16_t>(port));
+
+  if (bind(stats_fd_, reinterpret_cast<sockaddr*>(&stats_addr), sizeof(stats_addr)) < 0) {
+    std::cerr << "Bind failed on stats port " << port << ".\n";
+    return false;
+  }
+  if (listen(stats_fd_, 16) < 0) {
+    std::cerr << "Listen failed on stats port.\n";
+    return false;
+  }
+  return AdoptStatsListener(stats_fd_);
+}
+
+bool Reactor::AdoptStatsListener(int fd) {
+  stats_fd_ = fd;
+  return add_to_epoll(epoll_fd_, stats_fd_, EPOLLIN | EPOLLET, kStatsTag);
+}
+
+void Reactor::Start() {
+  running_.store(true);
+  thread_ = std::thread(&Reactor::Run, this);
+}
+
+void Reactor::Stop() {
+  running_.store(false);
+  if (wake_fd_ >= 0) {
+    uint64_t one = 1;
+    ssize_t ignored = write(wake_fd_, &one, sizeof(one));
+    (void)ignored;
+  }
+}
+
+void Reactor::Join() {
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void Reactor::Post(const MessageRef& message, uint64_t sender_id) {
+  bool was_empty = false;
+  {
+    std::lock_guard<std::mutex> lock(mailbox_mutex_);
+    was_empty = mailbox_.empty();
+    mailbox_.push_back({message, sender_id});
+  }
+  if (was_empty) {
+    uint64_t one = 1;
+    ssize_t ignored = write(wake_fd_, &one, sizeof(one));
+    (void)ignored;
+  }
+}
+
+void Reactor::PostTo(uint64_t connection_id, std::vector<MessageRef> messages) {
+  bool was_empty = false;
+  {
+    std::lock_guard<std::mutex> lock(mailbox_mutex_);
+    was_empty = mailbox_.empty();
+    for (MessageRef& message : messages) {
+      mailbox_.push_back({std::move(message), 0, connection_id});
+    }
+  }
+  if (was_empty) {
+    uint64_t one = 1;
+    ssize_t ignored = write(wake_fd_, &one, sizeof(one));
+    (void)ignored;
+  }
+}
+
+void Reactor::AdoptPeer(int fd, int peer_index) {
+  {
+    std::lock_guard<std::mutex> lock(mailbox_mutex_);
+    pending_peers_.push_back({fd, peer_index});
+  }
+  uint64_t one = 1;
+  ssize_t ignored = write(wake_fd_, &one, sizeof(one));
+  (void)ignored;
+}
+
+void Reactor::BeginHandoff() {
+  {
+    std::lock_guard<std::mutex> lock(mailbox_mutex_);
+    handoff_requested_ = true;
+  }
+  uint64_t one = 1;
+  ssize_t ignored = write(wake_fd_, &one, sizeof(one));
+  (void)ignored;
+}
+
+void Reactor::AppendClientStats(std::vector<ClientStats>* out) {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  out->insert(out->end(), client_stats_.begin(), client_stats_.end());
+}
+
+void Reactor::Run() {
+  // Requests a previous server process had received but not yet handled.
+  ProcessPendingInbound();
+  if (uring_) {
+    RunUring();
+  } else {
+    RunEpoll();
+  }
+}
+
+void Reactor::RunEpoll() {
+  epoll_event events[kMaxEvents];
+  next_tick_ = std::chrono::steady_clock::now() + kTickInterval;
+  next_dump_ = std::chrono::steady_clock::now() +
+               std::chrono::seconds(context_->stats_interval_seconds);
+  while (running_.load()) {
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+        next_tick_ - std::chrono::steady_clock::now());
+    int timeout_ms = static_cast<int>(std::max<int64_t>(0, wait.count()));
+    int count = epoll_wait(epoll_fd_, events, kMaxEvents, timeout_ms);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "Reactor " << index_ << ": epoll_wait failed.\n";
+      break;
+    }
+
+    for (int i = 0; i < count; ++i) {
+      uint64_t tag = events[i].data.u64;
+      if (tag == kListenerTag) {
+        AcceptAll();
+        continue;
+      }
+      if (tag == kWakeTag) {
+        DrainMailbox();
+        if (!running_.load()) {
+          // Handed off: the remaining events are the new process's now.
+          return;
+        }
+        continue;
+      }
+      if (tag == kStatsTag) {
+        ServeStats();
+        continue;
+      }
+      if (stats_replies_.count(tag) != 0) {
+        WriteStatsReply(tag);
+        continue;
+      }
+
+      auto it = connections_.find(tag);
+      if (it == connections_.end()) {
+        continue;
+      }
+      Connection& conn = it->second;
+      if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+        MarkClosing(conn);
+        continue;
+      }
+      if (events[i].events & EPOLLOUT) {
+        if (!Flush(conn)) {
+          MarkClosing(conn);
+          continue;
+        }
+      }
+      if (events[i].events & EPOLLIN) {
+        HandleReadable(conn);
+      }
+    }
+
+    while (!closing_.empty()) {
+      uint64_t id = closing_.back();
+      closing_.pop_back();
+      CloseConnection(id);
+    }
+
+    if (std::chrono::steady_clock::now() >= next_tick_) {
+      Tick();
+    }
+  }
+}
+
+void Reactor::AcceptAll() {
+  while (true) {
+    sockaddr_in client_addr{};
+    socklen_t client_len = sizeof(client_addr);
+    int client_fd = accept4(listen_fd_, reinterpret_cast<sockaddr*>(&client_addr), &client_len,
+                            SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return;
+      }
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      std::cerr << "Accept failed.\n";
+      return;
+    }
+    AddConnection(client_fd);
+  }
+}
+
+bool Reactor::Restore(HandoffConnection connection) {
+  int fd = connection.fd;
+  set_blocking(fd, uring_ != nullptr);
+  if (!uring_ &&
+      !add_to_epoll(epoll_fd_, fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, connection.id)) {
+    std::cerr << "Failed to register client fd " << fd << '\n';
+    close(fd);
+    return false;
+  }
+  Connection conn(&context_->outbound_limits);
+  conn.fd = fd;
+  conn.id = connection.id;
+  conn.handle = connection.handle;
+  conn.role = connection.role;
+  conn.registered = connection.registered;
+  conn.label = std::move(connection.label);
+  conn.prefix = std::move(connection.prefix);
+  conn.inbound = std::move(connection.inbound);
+  conn.format = connection.format;
+  conn.negotiated = connection.negotiated;
+  conn.channels = std::move(connection.channels);
+  conn.publish_channel = connection.publish_channel;
+  conn.publish_messages = TokenBucket(context_->client_message_rate);
+  conn.publish_bytes = TokenBucket(context_->client_byte_rate);
+  conn.rate_limited = connection.rate_limited;
+  conn.messages_in = connection.messages_in;
+  conn.bytes_in = connection.bytes_in;
+  conn.messages_out = connection.messages_out;
+  conn.bytes_out = connection.bytes_out;
+  context_->metrics.connections.fetch_add(1, std::memory_order_relaxed);
+  for (uint32_t channel : conn.channels) {
+    channels_.Subscribe(channel, conn.id);
+  }
+  Connection& added = connections_.emplace(conn.id, std::move(conn)).first->second;
+  if (uring_) {
+    ArmReceive(added);
+  }
+  if (!connection.outbound.empty()) {
+    Enqueue(added, Message::CreateRaw(connection.outbound), 0, false);
+  }
+  return true;
+}
+
+Connection* Reactor::AddConnection(int client_fd, int peer_index) {
+  uint64_t id = context_->next_client_id.fetch_add(1);
+  // Outbound peer sockets come from a blocking connect; only io_uring wants
+  // them that way.
+  if (peer_index >= 0 && !uring_) {
+    set_blocking(client_fd, false);
+  }
+  // During a handoff, Resume registers it with the rest.
+  if (!uring_ && !handing_off_ &&
+      !add_to_epoll(epoll_fd_, client_fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, id)) {
+    std::cerr << "Failed to register client fd " << client_fd << '\n';
+    close(client_fd);
+    return nullptr;
+  }
+  Connection conn(&context_->outbound_limits);
+  conn.fd = client_fd;
+  conn.id = id;
+  conn.handle = static_cast<uint32_t>(id);
+  conn.label = "Client" + std::to_string(id);
+  conn.prefix = conn.label + ": ";
+  conn.publish_messages = TokenBucket(context_->client_message_rate);
+  conn.publish_bytes = TokenBucket(context_->client_byte_rate);
+  context_->metrics.accepted.fetch_add(1, std::memory_order_relaxed);
+  context_->metrics.connections.fetch_add(1, std::memory_order_relaxed);
+
+  if (peer_index >= 0) {
+    conn.peer = true;
+    conn.peer_index = peer_index;
+    conn.format = WireFormat::kRelay;
+    conn.label = "Peer" + std::to_string(peer_index);
+    Connection& added = connections_.emplace(id, std::move(conn)).first->second;
+    peers_.push_back(id);
+    if (uring_ && !handing_off_) {
+      ArmReceive(added);
+    }
+    uint8_t handshake[kHelloSize + kFrameHeaderSize + 4];
+    encode_hello(kFrameVersion, handshake);
+    FrameHeader header;
+    header.type = FrameType::kPeer;
+    header.payload_size = 4;
+    encode_frame_header(header, handshake + kHelloSize);
+    put_u32(handshake + kHelloSize + kFrameHeaderSize, context_->server_id);
+    Enqueue(added, Message::CreateRaw(
+                       std::string_view(reinterpret_cast<char*>(handshake), sizeof(handshake))));
+    return &added;
+  }
+
+  MessageRef join_message =
+      Message::Create(FrameType::kNotice, kLobbyChannel, 0, {}, conn.label + " joined the chat.");
+  conn.channels.push_back(kLobbyChannel);
+  channels_.Subscribe(kLobbyChannel, id);
+  Connection& added = connections_.emplace(id, std::move(conn)).first->second;
+  if (uring_ && !handing_off_) {
+    ArmReceive(added);
+  }
+  SendLastStatus(added, kLobbyChannel);
+
+  Broadcast(join_message, id);
+  Echo(*join_message);
+  return &added;
+}
+
+bool Reactor::Receive(Connection& conn, const char* data, size_t size) {
+  conn.bytes_in += size;
+  context_->metrics.bytes_in.fetch_add(size, std::memory_order_relaxed);
+  conn.inbound.append(data, size);
+  // Left for whichever process continues after the handoff.
+  return handing_off_ || ProcessInbound(conn);
+}
+
+void Reactor::HandleReadable(Connection& conn) {
+  char buffer[kBufferSize];
+  while (true) {
+    ssize_t bytes_received = recv(conn.fd, buffer, sizeof(buffer), 0);
+    if (bytes_received > 0) {
+      if (!Receive(conn, buffer, static_cast<size_t>(bytes_received))) {
+        MarkClosing(conn);
+        return;
+      }
+      continue;
+    }
+    if (bytes_received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    MarkClosing(conn);
+    return;
+  }
+}
+
+bool Reactor::ProcessInbound(Connection& conn) {
+  if (!conn.negotiated && !NegotiateFormat(conn)) {
+    return false;
+  }
+  if (!conn.negotiated) {
+    return true;
+  }
+
+  size_t consumed = 0;
+  if (conn.format != WireFormat::kText) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(conn.inbound.data());
+    while (conn.inbound.size() - consumed >= kFrameHeaderSize) {
+      FrameView frame;
+      uint32_t max_payload = conn.peer ? kMaxRelayFramePayload : kMaxFramePayload;
+      if (!decode_frame_header(bytes + consumed, &frame.header, max_payload)) {
+        std::cerr << conn.label << " sent an invalid frame header.\n";
+        return false;
+      }
+      size_t frame_size = kFrameHeaderSize + frame.header.payload_size;
+      if (conn.inbound.size() - consumed < frame_size) {
+        break;
+      }
+      frame.payload = std::string_view(conn.inbound.data() + consumed + kFrameHeaderSize,
+                                       frame.header.payload_size);
+      HandleFrame(conn, frame);
+      consumed += frame_size;
+    }
+  } else {
+    while (consumed < conn.inbound.size()) {
+      size_t line_end = conn.inbound.find('\n', consumed);
+      if (line_end == std::string::npos) {
+        if (conn.inbound.size() - consumed < kMaxTextLine) {
+          break;
+        }
+        line_end = conn.inbound.size();
+      }
+      FrameView frame;
+      frame.payload = std::string_view(conn.inbound.data() + consumed, line_end - consumed);
+      frame.header.payload_size = static_cast<uint32_t>(frame.payload.size());
+      HandleFrame(conn, frame);
+      consumed = std::min(conn.inbound.size(), line_end + 1);
+    }
+  }
+  conn.inbound.erase(0, consumed);
+  return true;
+}
+
+bool Reactor::NegotiateFormat(Connection& conn) {
+  if (conn.peer) {
+    // Our own outbound link: wait for the peer's hello, skipping anything it
+    // queued before seeing ours.
+    size_t hello = conn.inbound.find(std::string_view("\0MSF", 4));
+    if (hello == std::string::npos || conn.inbound.size() - hello < kHelloSize) {
+      return conn.inbound.size() < kMaxTextLine;
+    }
+    conn.inbound.erase(0, hello + kHelloSize);
+    conn.negotiated = true;
+    return true;
+  }
+  if (conn.inbound.empty()) {
+    return true;
+  }
+  if (conn.inbound[0] != '\0') {
+    conn.format = WireFormat::kText;
+    conn.negotiated = true;
+    return true;
+  }
+  if (conn.inbound.size() < kHelloSize) {
+    return true;
+  }
+
+  uint8_t version = 0;
+  if (!decode_hello(reinterpret_cast<const uint8_t*>(conn.inbound.data()), &version) ||
+      version < kFrameVersion) {
+    std::cerr << conn.label << " sent an unsupported protocol hello.\n";
+    return false;
+  }
+
+  uint8_t reply[kHelloSize];
+  encode_hello(kFrameVersion, reply);
+  Enqueue(conn,
+          Message::CreateRaw(std::string_view(reinterpret_cast<char*>(reply), sizeof(reply))));
+  conn.inbound.erase(0, kHelloSize);
+  conn.format = WireFormat::kBinary;
+  conn.negotiated = true;
+  SendSessions(conn);
+  return true;
+}
+
+void Reactor::HandleFrame(Connection& conn, const FrameView& frame) {
+  ++conn.messages_in;
+  context_->metrics.messages_in.fetch_add(1, std::memory_order_relaxed);
+  if (conn.peer) {
+    HandleRelayFrame(conn, frame);
+    return;
+  }
+  if (conn.format == WireFormat::kText && !frame.payload.empty() && frame.payload[0] == '/') {
+    HandleCommand(conn, frame.payload);
+    return;
+  }
+
+  uint32_t channel = conn.format == WireFormat::kText ? conn.publish_channel : frame.header.channel;
+  std::string status_text;
+  switch (frame.header.type) {
+    case FrameType::kData:
+      break;
+    case FrameType::kSubscribe:
+      Subscribe(conn, frame.payload);
+      return;
+    case FrameType::kUnsubscribe:
+      Unsubscribe(conn, frame.payload);
+      return;
+    case FrameType::kRegister: {
+      ClientRole role;
+      std::string_view name;
+      if (!decode_register_payload(frame.payload, &role, &name)) {
+        SendNotice(conn, "Invalid registration.");
+        return;
+      }
+      Register(conn, role, name);
+      return;
+    }
+    case FrameType::kPeer:
+      AcceptPeer(conn, frame.payload);
+      return;
+    case FrameType::kReplay: {
+      if (frame.payload.size() < 9) {
+        return;
+      }
+      const uint8_t* bytes = reinterpret_cast<const uint8_t*>(frame.payload.data());
+      if (bytes[0] > static_cast<uint8_t>(ReplayFrom::kTime)) {
+        return;
+      }
+      Replay(conn, frame.payload.substr(9), static_cast<ReplayFrom>(bytes[0]), get_u64(bytes + 1));
+      return;
+    }
+    case FrameType::kTimeSync: {
+      int64_t client_ns = 0;
+      if (decode_time_sync_request(frame.payload, &client_ns)) {
+        SendTimeSync(conn, client_ns);
+      }
+      return;
+    }
+    case FrameType::kStatus: {
+      StatusRecord record;
+      if (!decode_status_record(frame.payload, &record)) {
+        return;
+      }
+      status_text = format_status_text(record);
+      break;
+    }
+    default:
+      return;
+  }
+  if (!AdmitPublish(conn, channel, frame.payload.size())) {
+    return;
+  }
+  MessageRef message =
+      Message::Create(frame.header.type, channel, conn.handle, conn.prefix, frame.payload,
+                      status_text, context_->NextMessageId());
+  CacheStatus(message);
+  Broadcast(message, conn.id);
+  Echo(*message);
+}
+
+void Reactor::HandleRelayFrame(Connection& conn, const FrameView& frame) {
+  if ((frame.header.flags & kFrameFlagRelayed) == 0 || frame.payload.size() < kRelayHeaderSize) {
+    return;
+  }
+  if (frame.header.type != FrameType::kData && frame.header.type != FrameType::kStatus &&
+      frame.header.type != FrameType::kRegister) {
+    return;
+  }
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(frame.payload.data());
+  uint64_t id = get_u64(bytes);
+  size_t prefix_size = get_u16(bytes + 8);
+  if (frame.payload.size() - kRelayHeaderSize < prefix_size) {
+    return;
+  }
+  // Either a cycle brought back one of our own messages or another link
+  // delivered this one first.
+  if (static_cast<uint32_t>(id >> 32) == context_->server_id ||
+      !context_->relayed_ids.Insert(id)) {
+    context_->metrics.relay_duplicates.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  context_->metrics.relayed.fetch_add(1, std::memory_order_relaxed);
+
+  std::string_view prefix = frame.payload.substr(kRelayHeaderSize, prefix_size);
+  std::string_view payload = frame.payload.substr(kRelayHeaderSize + prefix_size);
+  // Text renderings are rebuilt here rather than carried on the link.
+  std::string text;
+  StatusRecord record;
+  ClientRole role;
+  std::string_view name;
+  if (frame.header.type == FrameType::kStatus) {
+    if (!decode_status_record(payload, &record)) {
+      return;
+    }
+    text = format_status_text(record);
+  } else if (frame.header.type == FrameType::kRegister) {
+    if (!decode_register_payload(payload, &role, &name)) {
+      return;
+    }
+    text = registration_text(name, role);
+  }
+  MessageRef message = Message::Create(frame.header.type, frame.header.channel,
+                                       frame.header.sender_id, prefix, payload, text, id);
+  CacheStatus(message);
+  Broadcast(message, conn.id);
+  Echo(*message);
+}
+
+bool Reactor::AdmitPublish(Connection& conn, uint32_t channel, size_t bytes) {
+  int64_t now = steady_now_ns();
+  if (!conn.publish_messages.TryTake(1, now) ||
+      !conn.publish_bytes.TryTake(static_cast<double>(bytes), now) ||
+      !context_->channel_limiter.Admit(channel, now)) {
+    ++conn.rate_limited;
+    context_->metrics.rate_limited.fetch_add(1, std::memory_order_relaxed);
+    if (now >= conn.next_rate_notice_ns) {
+      conn.next_rate_notice_ns = now + kRateNoticeIntervalNs;
+      SendNotice(conn, "Rate limit exceeded; messages are being dropped.");
+    }
+    return false;
+  }
+
+  size_t depth = 0;
+  if (now >= conn.next_pressure_check_ns) {
+    if (context_->channel_limiter.Pressure(channel, now, &depth)) {
+      conn.next_pressure_check_ns = now + kBackpressureIntervalNs;
+      context_->metrics.backpressure_signals.fetch_add(1, std::memory_order_relaxed);
+      uint32_t queued = static_cast<uint32_t>(depth);
+      Enqueue(conn, Message::Create(FrameType::kBackpressure, channel, 0, {},
+                                    encode_backpressure_payload(queued),
+                                    backpressure_text(queued)));
+    } else {
+      conn.next_pressure_check_ns = now + kPressureCheckIntervalNs;
+    }
+  }
+  return true;
+}
+
+void Reactor::AcceptPeer(Connection& conn, std::string_view payload) {
+  if (payload.size() != 4) {
+    return;
+  }
+  // A peer link announces itself right after the hello; a client that has
+  // already registered or subscribed cannot turn into one.
+  if (conn.registered || conn.messages_in != 1) {
+    std::cerr << conn.label << " sent a peer hello mid-session, closing.\n";
+    MarkClosing(conn);
+    return;
+  }
+  sockaddr_in address{};
+  socklen_t address_size = sizeof(address);
+  if (getpeername(conn.fd, reinterpret_cast<sockaddr*>(&address), &address_size) != 0 ||
+      address.sin_family != AF_INET || !context_->peer_connector ||
+      !context_->peer_connector->Accepts(address.sin_addr.s_addr)) {
+    char text[INET_ADDRSTRLEN] = "unknown";
+    inet_ntop(AF_INET, &address.sin_addr, text, sizeof(text));
+    std::cerr << "Refused peer link from " << text << ".\n";
+    MarkClosing(conn);
+    return;
+  }
+  uint32_t server_id = get_u32(reinterpret_cast<const uint8_t*>(payload.data()));
+  if (server_id == context_->server_id) {
+    std::cerr << conn.label << " is a peer link to this server, closing.\n";
+    MarkClosing(conn);
+    return;
+  }
+  // Peers receive every relayed message, not per-channel fan-out.
+  for (uint32_t channel : conn.channels) {
+    channels_.Unsubscribe(channel, conn.id);
+  }
+  conn.channels.clear();
+  conn.peer = true;
+  conn.format = WireFormat::kRelay;
+  conn.label = "Peer" + std::to_string(server_id);
+  peers_.push_back(conn.id);
+  std::cout << conn.label << " linked.\n";
+}
+
+void Reactor::HandleCommand(Connection& conn, std::string_view line) {
+  if (!line.empty() && line.back() == '\r') {
+    line.remove_suffix(1);
+  }
+  size_t space = line.find(' ');
+  std::string_view command = line.substr(0, space);
+  std::string_view argument;
+  if (space != std::string_view::npos) {
+    argument = line.substr(space + 1);
+  }
+
+  if (command == "/subscribe") {
+    Subscribe(conn, argument);
+  } else if (command == "/unsubscribe") {
+    Unsubscribe(conn, argument);
+  } else if (command == "/publish") {
+    if (!valid_channel_name(argument)) {
+      SendNotice(conn, "Invalid channel name.");
+      return;
+    }
+    conn.publish_channel = channel_id(argument);
+  } else if (command == "/replay") {
+    std::string_view channel = next_word(&argument);
+    std::string_view mode = next_word(&argument);
+    std::string start(argument);
+    char* end = nullptr;
+    uint64_t value = std::strtoull(start.c_str(), &end, 10);
+    if ((mode != "seq" && mode != "since") || start.empty() || *end != '\0') {
+      SendNotice(conn, "Usage: /replay <channel> seq <N> | /replay <channel> since <unix_ms>");
+      return;
+    }
+    Replay(conn, channel, mode == "seq" ? ReplayFrom::kSequence : ReplayFrom::kTime, value);
+  } else if (command == "/time") {
+    std::string start(argument);
+    char* end = nullptr;
+    int64_t client_ns = std::strtoll(start.c_str(), &end, 10);
+    if (start.empty() || *end != '\0') {
+      SendNotice(conn, "Usage: /time <client_ns>");
+      return;
+    }
+    SendTimeSync(conn, client_ns);
+  } else if (command == "/register") {
+    size_t split = argument.find(' ');
+    std::string_view name = argument.substr(0, split);
+    ClientRole role = ClientRole::kNone;
+    if (split == std::string_view::npos || !valid_client_name(name) ||
+        !parse_client_role(argument.substr(split + 1), &role)) {
+      SendNotice(conn, "Usage: /register <name> leader|follower|monitor");
+      return;
+    }
+    Register(conn, role, name);
+  } else {
+    SendNotice(conn, "Unknown command: " + std::string(command));
+  }
+}
+
+void Reactor::Register(Connection& conn, ClientRole role, std::string_view name) {
+  if (conn.registered) {
+    SendNotice(conn, "Already registered as " + conn.label + ".");
+    return;
+  }
+  uint32_t handle = 0;
+  if (!context_->sessions.Attach(name, role, conn.id, &handle)) {
+    SendNotice(conn, "Name " + std::string(name) + " is in use by another connection.");
+    return;
+  }
+  conn.handle = handle;
+  conn.role = role;
+  conn.registered = true;
+  conn.label = std::string(name);
+  conn.prefix = conn.label + ": ";
+
+  // Sent to the lobby including the sender, which learns its handle from it.
+  MessageRef message = Message::Create(
+      FrameType::kRegister, kLobbyChannel, conn.handle, {}, encode_register_payload(role, name),
+      registration_text(name, role), context_->NextMessageId());
+  Broadcast(message, 0);
+  Echo(*message);
+}
+
+void Reactor::SendSessions(Connection& conn) {
+  // Binary frames carry only the sender's handle; replay the registrations
+  // of everyone online so the new client can put names to them.
+  for (const Session& session : context_->sessions.Snapshot()) {
+    if (session.connection_id != 0) {
+      Enqueue(conn,
+              Message::Create(FrameType::kRegister, kLobbyChannel, session.handle, {},
+                              encode_register_payload(session.role, session.name)),
+              0, false);
+    }
+  }
+}
+
+void Reactor::Subscribe(Connection& conn, std::string_view channel_name) {
+  if (!valid_channel_name(channel_name)) {
+    SendNotice(conn, "Invalid channel name.");
+    return;
+  }
+  uint32_t channel = channel_id(channel_name);
+  if (channels_.Subscribe(channel, conn.id)) {
+    conn.channels.push_back(channel);
+    SendLastStatus(conn, channel);
+  }
+}
+
+void Reactor::CacheStatus(const MessageRef& message) {
+  if (!is_status_message(message->type(), message->payload())) {
+    return;
+  }
+  if (ends_playback(*message)) {
+    context_->last_status.Evict(message->channel(), message->sender_id());
+  } else {
+    context_->last_status.Store(message->channel(), message, steady_now_ns());
+  }
+}
+
+void Reactor::SendLastStatus(Connection& conn, uint32_t channel) {
+  MessageRef latest = context_->last_status.Lookup(channel, steady_now_ns());
+  if (latest && latest->sender_id() != conn.handle) {
+    Enqueue(conn, latest, 0, false);
+  }
+}
+
+void Reactor::Replay(Connection& conn, std::string_view channel_name, ReplayFrom from,
+                     uint64_t start) {
+  if (!context_->message_log) {
+    SendNotice(conn, "Replay is not enabled on this server.");
+    return;
+  }
+  if (!valid_channel_name(channel_name)) {
+    SendNotice(conn, "Invalid channel name.");
+    return;
+  }
+  // Half the queue, so a replay does not evict live traffic on its own.
+  const OutboundLimits& limits = context_->outbound_limits;
+  MessageLog::ReplayRequest request;
+  request.channel = channel_id(channel_name);
+  request.by_time = from == ReplayFrom::kTime;
+  request.from = start;
+  request.max_messages = std::max<size_t>(1, limits.max_messages / 2);
+  request.max_bytes = std::max<size_t>(1, limits.max_bytes / 2);
+  uint64_t connection_id = conn.id;
+  std::string name(channel_name);
+  context_->message_log->Replay(request, [this, connection_id, name](
+                                             MessageLog::ReplayResult result) {
+    std::string summary;
+    if (result.next_seq == 0) {
+      summary = "Nothing logged on " + name + ".";
+    } else if (result.messages.empty()) {
+      summary = "No messages to replay on " + name + "; next seq " +
+                std::to_string(result.next_seq) + ".";
+    } else {
+      summary = "Replayed " + std::to_string(result.messages.size()) + " message(s) of " + name +
+                ", seq " + std::to_string(result.first_seq) + " to " +
+                std::to_string(result.next_seq - 1) + "; next seq " +
+                std::to_string(result.next_seq) + ".";
+    }
+    result.messages.push_back(Message::Create(FrameType::kNotice, kLobbyChannel, 0, {}, summary));
+    PostTo(connection_id, std::move(result.messages));
+  });
+}
+
+void Reactor::Unsubscribe(Connection& conn, std::string_view channel_name) {
+  if (!valid_channel_name(channel_name)) {
+    SendNotice(conn, "Invalid channel name.");
+    return;
+  }
+  uint32_t channel = channel_id(channel_name);
+  if (channels_.Unsubscribe(channel, conn.id)) {
+    conn.channels.erase(std::remove(conn.channels.begin(), conn.channels.end(), channel),
+                        conn.channels.end());
+  }
+}
+
+void Reactor::SendNotice(Connection& conn, const std::string& text) {
+  Enqueue(conn, Message::Create(FrameType::kNotice, kLobbyChannel, 0, {}, text));
+}
+
+void Reactor::SendTimeSync(Connection& conn, int64_t client_ns) {
+  int64_t server_ns = unix_now_ns();
+  Enqueue(conn, Message::Create(FrameType::kTimeSync, kLobbyChannel, 0, {},
+                                encode_time_sync_reply(client_ns, server_ns),
+                                time_sync_text(client_ns, server_ns)));
+}
+
+void Reactor::DrainMailbox() {
+  uint64_t counter = 0;
+  ssize_t ignored = read(wake_fd_, &counter, sizeof(counter));
+  (void)ignored;
+
+  std::vector<PendingMessage> pending;
+  std::vector<PendingPeer> peers;
+  bool handoff = false;
+  {
+    std::lock_guard<std::mutex> lock(mailbox_mutex_);
+    pending.swap(mailbox_);
+    peers.swap(pending_peers_);
+    handoff = handoff_requested_;
+    handoff_requested_ = false;
+  }
+  for (const PendingPeer& peer : peers) {
+    if (!AddConnection(peer.fd, peer.index)) {
+      context_->peer_connector->Disconnected(peer.index);
+    }
+  }
+  for (const PendingMessage& message : pending) {
+    if (message.target == 0) {
+      DeliverLocal(message.message, message.sender_id);
+      continue;
+    }
+    auto it = connections_.find(message.target);
+    if (it != connections_.end()) {
+      Enqueue(it->second, message.message, 0, false);
+    }
+  }
+  if (handoff && !handing_off_) {
+    Quiesce();
+  }
+}
+
+void Reactor::ProcessPendingInbound() {
+  for (auto& entry : connections_) {
+    Connection& conn = entry.second;
+    if (!conn.closing && !conn.inbound.empty() && !ProcessInbound(conn)) {
+      MarkClosing(conn);
+    }
+  }
+}
+
+void Reactor::Quiesce() {
+  handing_off_ = true;
+  if (uring_) {
+    // Cancelled operations still complete; RunUring hands off once nothing
+    // is in flight.
+    if (accepting_) {
+      CancelIo(listen_fd_);
+    }
+    for (auto& entry : connections_) {
+      if (entry.second.inflight > 0) {
+        CancelIo(entry.second.fd);
+      }
+    }
+    return;
+  }
+  // Unread data stays in the socket buffers for the next process.
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, listen_fd_, nullptr);
+  for (auto& entry : connections_) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, entry.second.fd, nullptr);
+  }
+  HandOff();
+}
+
+bool Reactor::Quiesced() const {
+  if (accepting_) {
+    return false;
+  }
+  for (const auto& entry : connections_) {
+    if (entry.second.inflight > 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Reactor::HandOff() {
+  while (!closing_.empty()) {
+    uint64_t id = closing_.back();
+    closing_.pop_back();
+    CloseConnection(id);
+  }
+  context_->hot_restart->WaitForQuiesce();
+  // Messages other reactors posted before they stopped.
+  DrainMailbox();
+
+  std::vector<HandoffConnection> connections;
+  for (auto& entry : connections_) {
+    Connection& conn = entry.second;
+    if (conn.peer || conn.closing) {
+      continue;
+    }
+    HandoffConnection out;
+    out.fd = conn.fd;
+    out.id = conn.id;
+    out.handle = conn.handle;
+    out.role = conn.role;
+    out.registered = conn.registered;
+    out.format = conn.format;
+    out.negotiated = conn.negotiated;
+    out.label = conn.label;
+    out.prefix = conn.prefix;
+    out.channels = conn.channels;
+    out.publish_channel = conn.publish_channel;
+    out.inbound = conn.inbound;
+    out.outbound = conn.outbound.Unsent();
+    out.rate_limited = conn.rate_limited;
+    out.messages_in = conn.messages_in;
+    out.bytes_in = conn.bytes_in;
+    out.messages_out = conn.messages_out;
+    out.bytes_out = conn.bytes_out;
+    connections.push_back(std::move(out));
+  }
+  if (context_->hot_restart->Submit(index_, listen_fd_, stats_fd_, std::move(connections))) {
+    // The new process owns every socket now. Ours close when this process
+    // exits, without a word to the clients.
+    running_.store(false);
+    return;
+  }
+  Resume();
+}
+
+void Reactor::Resume() {
+  handing_off_ = false;
+  for (auto& entry : connections_) {
+    Connection& conn = entry.second;
+    // The new process may have switched the socket's mode before failing.
+    set_blocking(conn.fd, uring_ != nullptr);
+    if (!uring_) {
+      add_to_epoll(epoll_fd_, conn.fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, conn.id);
+    } else if (!conn.closing) {
+      ArmReceive(conn);
+      if (!conn.outbound.empty()) {
+        ScheduleSend(conn);
+      }
+    }
+  }
+  if (uring_) {
+    ArmAccept();
+  } else {
+    add_to_epoll(epoll_fd_, listen_fd_, EPOLLIN | EPOLLET, kListenerTag);
+  }
+  ProcessPendingInbound();
+}
+
+bool Reactor::Flush(Connection& conn) {
+  FlushStats stats;
+  bool ok = conn.outbound.Flush(conn.fd, &stats, &context_->metrics.fanout_latency);
+  conn.messages_out += stats.messages;
+  conn.bytes_out += stats.bytes;
+  context_->metrics.messages_out.fetch_add(stats.messages, std::memory_order_relaxed);
+  context_->metrics.bytes_out.fetch_add(stats.bytes, std::memory_order_relaxed);
+  if (!ok) {
+    std::cerr << "Failed to send to client fd " << conn.fd << '\n';
+    return false;
+  }
+  return true;
+}
+
+void Reactor::Enqueue(Connection& conn, const MessageRef& message, uint64_t conflation_key,
+                      bool timed) {
+  if (conn.closing) {
+    return;
+  }
+  bool idle = conn.outbound.empty();
+  uint64_t dropped_before = conn.outbound.dropped();
+  OutboundQueue::PushResult result =
+      conn.outbound.Push(message, conn.format, conflation_key, timed);
+  // Live published traffic piling up past half the queue, or already being
+  // shed, means the channel's publishers should hear about it.
+  const OutboundLimits& limits = context_->outbound_limits;
+  if (timed && message->sender_id() != 0 &&
+      (result != OutboundQueue::PushResult::kQueued ||
+       conn.outbound.size() * 2 >= limits.max_messages ||
+       conn.outbound.bytes() * 2 >= limits.max_bytes)) {
+    int64_t now = steady_now_ns();
+    if (now >= conn.next_pressure_report_ns) {
+      conn.next_pressure_report_ns = now + kPressureCheckIntervalNs;
+      context_->channel_limiter.ReportPressure(message->channel(), conn.outbound.size(), now);
+    }
+  }
+  if (conn.outbound.dropped() != dropped_before) {
+    context_->metrics.dropped.fetch_add(conn.outbound.dropped() - dropped_before,
+                                        std::memory_order_relaxed);
+  }
+  if (result == OutboundQueue::PushResult::kConflated) {
+    context_->metrics.conflated.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (result == OutboundQueue::PushResult::kOverflow) {
+    context_->metrics.overflow_disconnects.fetch_add(1, std::memory_order_relaxed);
+    std::cerr << conn.label << " outbound queue overflow, disconnecting.\n";
+    MarkClosing(conn);
+    return;
+  }
+  if (!idle || handing_off_) {
+    return;
+  }
+  if (uring_) {
+    ScheduleSend(conn);
+  } else if (!Flush(conn)) {
+    MarkClosing(conn);
+  }
+}
+
+void Reactor::MarkClosing(Connection& conn) {
+  if (!conn.closing) {
+    conn.closing = true;
+    closing_.push_back(conn.id);
+  }
+}
+
+void Reactor::CloseConnection(uint64_t id) {
+  auto it = connections_.find(id);
+  if (it == connections_.end() || it->second.closed) {
+    return;
+  }
+  Connection& conn = it->second;
+  conn.closed = true;
+  context_->metrics.connections.fetch_sub(1, std::memory_order_relaxed);
+  if (conn.registered) {
+    context_->sessions.Detach(conn.handle, conn.id);
+  }
+  for (uint32_t channel : conn.channels) {
+    channels_.Unsubscribe(channel, id);
+  }
+  bool peer = conn.peer;
+  if (peer) {
+    peers_.erase(std::remove(peers_.begin(), peers_.end(), id), peers_.end());
+    std::cout << conn.label << " unlinked.\n";
+    if (conn.peer_index >= 0) {
+      context_->peer_connector->Disconnected(conn.peer_index);
+    }
+  }
+  MessageRef leave_message;
+  if (!peer) {
+    context_->last_status.EvictSender(conn.handle);
+    leave_message = Message::Create(FrameType::kNotice, kLobbyChannel, 0, {},
+                                    conn.label + " left the chat.");
+  }
+  if (uring_) {
+    // Ends the pending receive and any blocked send; the connection is
+    // released once both have completed.
+    shutdown(conn.fd, SHUT_RDWR);
+    ReleaseIfIdle(conn);
+  } else {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn.fd, nullptr);
+    close(conn.fd);
+    connections_.erase(it);
+  }
+
+  if (leave_message) {
+    Broadcast(leave_message, id);
+    Echo(*leave_message);
+  }
+}
+
+void Reactor::Broadcast(const MessageRef& message, uint64_t sender_id) {
+  if (context_->message_log && message->id() != 0) {
+    context_->message_log->Append(message);
+  }
+  DeliverLocal(message, sender_id);
+  for (Reactor* reactor : context_->reactors) {
+    if (reactor != this) {
+      reactor->Post(message, sender_id);
+    }
+  }
+}
+
+void Reactor::DeliverLocal(const MessageRef& message, uint64_t sender_id) {
+  const std::vector<uint64_t>* subscribers = channels_.Subscribers(message->channel());
+  // Messages with an id go to every peer link as well; each peer fans out to
+  // its own subscribers.
+  bool relay = message->id() != 0 && !peers_.empty();
+  if (!subscribers && !relay) {
+    return;
+  }
+  uint64_t conflation_key = 0;
+  if (context_->conflate && message->sender_id() != 0 &&
+      is_status_message(message->type(), message->payload())) {
+    conflation_key = (static_cast<uint64_t>(message->channel()) << 32) | message->sender_id();
+  }
+  auto deliver = [&](const std::vector<uint64_t>& ids) {
+    for (uint64_t id : ids) {
+      if (id == sender_id) {
+        continue;
+      }
+      auto it = connections_.find(id);
+      if (it != connections_.end()) {
+        Enqueue(it->second, message, conflation_key);
+      }
+    }
+  };
+  if (subscribers) {
+    deliver(*subscribers);
+  }
+  if (relay) {
+    deliver(peers_);
+  }
+}
+
+void Reactor::Echo(const Message& message) const {
+  if (context_->echo) {
+    std::cout << message.prefix() << message.text_payload() << '\n';
+  }
+}
+
+void Reactor::Tick() {
+  auto now = std::chrono::steady_clock::now();
+  next_tick_ = now + kTickInterval;
+  PublishClientStats();
+  ExpireStatsReplies(now);
+  if (index_ != 0) {
+    return;
+  }
+  context_->metrics.Sample();
+  context_->channel_limiter.Prune(steady_now_ns());
+  if (context_->stats_interval_seconds > 0 && now >= next_dump_) {
+    next_dump_ = now + std::chrono::seconds(context_->stats_interval_seconds);
+    std::cout << RenderStats() << std::flush;
+  }
+}
+
+void Reactor::PublishClientStats() {
+  std::vector<ClientStats> snapshot;
+  snapshot.reserve(connections_.size());
+  for (const auto& entry : connections_) {
+    const Connection& conn = entry.second;
+    if (conn.closed) {
+      continue;
+    }
+    ClientStats stats;
+    stats.id = conn.id;
+    stats.handle = conn.handle;
+    stats.label = conn.label;
+    stats.role = conn.role;
+    stats.format = conn.format;
+    stats.channels = conn.channels.size();
+    stats.queue_messages = conn.outbound.size();
+    stats.queue_bytes = conn.outbound.bytes();
+    stats.dropped = conn.outbound.dropped();
+    stats.conflated = conn.outbound.conflated();
+    stats.rate_limited = conn.rate_limited;
+    stats.messages_in = conn.messages_in;
+    stats.bytes_in = conn.bytes_in;
+    stats.messages_out = conn.messages_out;
+    stats.bytes_out = conn.bytes_out;
+    snapshot.push_back(std::move(stats));
+  }
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  client_stats_.swap(snapshot);
+}
+
+std::string Reactor::RenderStats() {
+  // This reactor's own clients are refreshed now; the others are at most one
+  // tick old.
+  PublishClientStats();
+  std::vector<ClientStats> clients;
+  for (Reactor* reactor : context_->reactors) {
+    reactor->AppendClientStats(&clients);
+  }
+  std::sort(clients.begin(), clients.end(),
+            [](const ClientStats& a, const ClientStats& b) { return a.id < b.id; });
+  std::vector<Session> sessions = context_->sessions.Snapshot();
+  std::sort(sessions.begin(), sessions.end(),
+            [](const Session& a, const Session& b) { return a.handle < b.handle; });
+  return context_->metrics.Render(clients, sessions);
+}
+
+void Reactor::ServeStats() {
+  while (true) {
+    int fd = accept4(stats_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      return;
+    }
+    std::string body = RenderStats();
+    StatsReply reply;
+    reply.fd = fd;
+    reply.response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nContent-Length: " +
+                     std::to_string(body.size()) + "\r\n\r\n" + body;
+    reply.deadline = std::chrono::steady_clock::now() + kStatsReplyTimeout;
+    uint64_t id = context_->next_client_id.fetch_add(1);
+    stats_replies_.emplace(id, std::move(reply));
+    WriteStatsReply(id);
+  }
+}
+
+void Reactor::WriteStatsReply(uint64_t id) {
+  auto it = stats_replies_.find(id);
+  if (it == stats_replies_.end()) {
+    return;
+  }
+  StatsReply& reply = it->second;
+  while (reply.sent < reply.response.size()) {
+    ssize_t n = send(reply.fd, reply.response.data() + reply.sent,
+                     reply.response.size() - reply.sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // A slow reader: the rest goes out when the socket is writable again.
+      if (uring_) {
+        if (!ArmStatsReply(id, reply.fd)) {
+          break;
+        }
+      } else if (!reply.watched) {
+        reply.watched = add_to_epoll(epoll_fd_, reply.fd, EPOLLOUT | EPOLLET, id);
+        if (!reply.watched) {
+          break;
+        }
+      }
+      return;
+    }
+    if (n <= 0) {
+      break;
+    }
+    reply.sent += static_cast<size_t>(n);
+  }
+
+  // Drain whatever request was sent so close() does not reset the stream.
+  char request[1024];
+  while (recv(reply.fd, request, sizeof(request), MSG_DONTWAIT) > 0) {
+  }
+  shutdown(reply.fd, SHUT_WR);
+  close(reply.fd);
+  stats_replies_.erase(it);
+}
+
+void Reactor::ExpireStatsReplies(std::chrono::steady_clock::time_point now) {
+  std::vector<uint64_t> expired;
+  for (auto& entry : stats_replies_) {
+    if (now >= entry.second.deadline) {
+      expired.push_back(entry.first);
+    }
+  }
+  for (uint64_t id : expired) {
+    // The failed send closes it; with io_uring, once the pending poll has
+    // completed.
+    shutdown(stats_replies_[id].fd, SHUT_RDWR);
+    if (!uring_) {
+      WriteStatsReply(id);
+    }
+  }
+}
@@ -0,0 +1,288 @@
+#ifndef MEDIA_STREAM_REACTOR_H_
+#define MEDIA_STREAM_REACTOR_H_
+
+#include <linux/time_types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "channel_index.h"
+#include "channel_limiter.h"
+#include "frame.h"
+#include "last_value_cache.h"
+#include "message.h"
+#include "outbound_queue.h"
+#include "recent_ids.h"
+#include "server_metrics.h"
+#include "session_registry.h"
+#include "token_bucket.h"
+
+class HotRestart;
+class MessageLog;
+class PeerConnector;
+class Reactor;
+class Uring;
+struct HandoffConnection;
+struct io_uring_cqe;
+
+enum class IoBackend {
+  kEpoll,
+  kUring,
+};
+
+bool parse_io_backend(const std::string& name, IoBackend* out);
+
+// State shared by every reactor thread of one server process.
+struct ServerContext {
+  std::vector<Reactor*> reactors;
+  std::atomic<uint64_t> next_client_id{1};
+  SessionRegistry sessions{&next_client_id};
+  bool echo = true;
+  OutboundLimits outbound_limits;
+  LastValueCache last_status;
+  // Replace queued-but-unsent status updates per channel and sender.
+  bool conflate = false;
+  ServerMetrics metrics;
+  // Print the stats report to stdout this often; 0 disables the dump.
+  int stats_interval_seconds = 0;
+  IoBackend io_backend = IoBackend::kEpoll;
+  // Publish limits per connection (messages and payload bytes per second)
+  // and per channel; 0 disables a limit.
+  double client_message_rate = 0;
+  double client_byte_rate = 0;
+  ChannelLimiter channel_limiter;
+
+  // Relay mesh. Ids of locally published messages carry server_id in the top
+  // half, so a server recognises its own messages when a cycle returns them.
+  uint32_t server_id = 1;
+  std::atomic<uint32_t> next_message_seq{1};
+  RecentIds relayed_ids{64 * 1024};
+  PeerConnector* peer_connector = nullptr;
+  // Every message with an id is appended here when set.
+  MessageLog* message_log = nullptr;
+  HotRestart* hot_restart = nullptr;
+
+  uint64_t NextMessageId() {
+    return (static_cast<uint64_t>(server_id) << 32) |
+           next_message_seq.fetch_add(1, std::memory_order_relaxed);
+  }
+};
+
+struct Connection {
+  explicit Connection(const OutboundLimits* limits) : outbound(limits) {}
+
+  int fd = -1;
+  uint64_t id = 0;
+  // Sender id stamped on everything this connection publishes: its session
+  // handle once registered, its connection id until then.
+  uint32_t handle = 0;
+  ClientRole role = ClientRole::kNone;
+  bool registered = false;
+  // Link to another relay server. peer_index is the PeerConnector slot of a
+  // link this server opened, -1 for one it accepted.
+  bool peer = false;
+  int peer_index = -1;
+  std::string label;
+  std::string prefix;
+  OutboundQueue outbound;
+  std::string inbound;
+  WireFormat format = WireFormat::kText;
+  bool negotiated = false;
+  bool closing = false;
+  std::vector<uint32_t> channels;
+  uint32_t publish_channel = kLobbyChannel;
+  TokenBucket publish_messages;
+  TokenBucket publish_bytes;
+  uint64_t rate_limited = 0;
+  // steady_clock deadlines that throttle notices and pressure bookkeeping.
+  int64_t next_rate_notice_ns = 0;
+  int64_t next_pressure_check_ns = 0;
+  int64_t next_pressure_report_ns = 0;
+  uint64_t messages_in = 0;
+  uint64_t bytes_in = 0;
+  uint64_t messages_out = 0;
+  uint64_t bytes_out = 0;
+
+  // io_uring backend only. A closed connection stays allocated until the
+  // kernel returns every operation still referencing it.
+  int inflight = 0;
+  bool closed = false;
+  // A send, or the wait for a stalled socket to become writable, is pending.
+  bool sending = false;
+  bool send_scheduled = false;
+  msghdr send_header{};
+  std::vector<iovec> send_iov;
+};
+
+// One event loop thread, driven by edge-triggered epoll or by io_uring. Each
+// reactor owns a SO_REUSEPORT listener and every connection it accepts;
+// messages for connections owned by other reactors are handed over through
+// their mailbox.
+class Reactor {
+ public:
+  Reactor(int index, ServerContext* context);
+  ~Reactor();
+
+  bool Listen(int port, bool reuse_port);
+  // Hot restart, before Start: serve a listener or a client connection
+  // inherited from the previous server process.
+  bool AdoptListener(int fd);
+  bool AdoptStatsListener(int fd);
+  bool Restore(HandoffConnection connection);
+  // Serves the plain-text stats report to anyone connecting to
+  // 127.0.0.1:port; only one reactor should listen.
+  bool ListenStats(int port);
+  void Start();
+  void Stop();
+  void Join();
+
+  // Thread-safe: queues a message for delivery to this reactor's connections.
+  void Post(const MessageRef& message, uint64_t sender_id);
+  // Thread-safe: queues messages for one connection only.
+  void PostTo(uint64_t connection_id, std::vector<MessageRef> messages);
+  // Thread-safe: hands over a connected socket to relay peer `peer_index`.
+  void AdoptPeer(int fd, int peer_index);
+  // Thread-safe: stops all I/O and submits this reactor's connections to the
+  // hot restart in progress.
+  void BeginHandoff();
+
+  // Thread-safe: appends this reactor's per-client stats as of its last tick.
+  void AppendClientStats(std::vector<ClientStats>* out);
+
+ private:
+  struct PendingMessage {
+    MessageRef message;
+    uint64_t sender_id;
+    // Non-zero: deliver to this connection only, whatever its channels.
+    uint64_t target = 0;
+  };
+
+  // A stats report still being written to a reader.
+  struct StatsReply {
+    int fd = -1;
+    std::string response;
+    size_t sent = 0;
+    std::chrono::steady_clock::time_point deadline;
+    // Registered with epoll for writability.
+    bool watched = false;
+  };
+
+  struct PendingPeer {
+    int fd;
+    int index;
+  };
+
+  void Run();
+  void RunEpoll();
+  bool RegisterListener();
+  void AcceptAll();
+  Connection* AddConnection(int client_fd, int peer_index = -1);
+  void HandleReadable(Connection& conn);
+  bool Receive(Connection& conn, const char* data, size_t size);
+  bool ProcessInbound(Connection& conn);
+  bool NegotiateFormat(Connection& conn);
+  void HandleFrame(Connection& conn, const FrameView& frame);
+  void HandleRelayFrame(Connection& conn, const FrameView& frame);
+  bool AdmitPublish(Connection& conn, uint32_t channel, size_t bytes);
+  void AcceptPeer(Connection& conn, std::string_view payload);
+  void HandleCommand(Connection& conn, std::string_view line);
+  void Register(Connection& conn, ClientRole role, std::string_view name);
+  void SendSessions(Connection& conn);
+  void Subscribe(Connection& conn, std::string_view channel_name);
+  void Unsubscribe(Connection& conn, std::string_view channel_name);
+  // Keeps a status for late subscribers, or forgets the channel's status
+  // when its player stopped.
+  void CacheStatus(const MessageRef& message);
+  void SendLastStatus(Connection& conn, uint32_t channel);
+  void Replay(Connection& conn, std::string_view channel_name, ReplayFrom from, uint64_t start);
+  void SendNotice(Connection& conn, const std::string& text);
+  // Answers a clock probe with the server's Unix time.
+  void SendTimeSync(Connection& conn, int64_t client_ns);
+  void DrainMailbox();
+  void ProcessPendingInbound();
+  void Quiesce();
+  bool Quiesced() const;
+  void HandOff();
+  void Resume();
+  bool Flush(Connection& conn);
+  void Enqueue(Connection& conn, const MessageRef& message, uint64_t conflation_key = 0,
+               bool timed = true);
+  void MarkClosing(Connection& conn);
+  void CloseConnection(uint64_t id);
+  void Broadcast(const MessageRef& message, uint64_t sender_id);
+  void DeliverLocal(const MessageRef& message, uint64_t sender_id);
+  void Echo(const Message& message) const;
+  void Tick();
+  void PublishClientStats();
+  std::string RenderStats();
+  void ServeStats();
+  // Writes as much of a stats report as the socket takes; closes it when
+  // done or failed.
+  void WriteStatsReply(uint64_t id);
+  void ExpireStatsReplies(std::chrono::steady_clock::time_point now);
+
+  // io_uring backend (reactor_uring.cpp).
+  bool InitUring();
+  void RunUring();
+  void HandleCompletion(const io_uring_cqe& cqe);
+  void HandleReceiveCompletion(Connection& conn, const io_uring_cqe& cqe);
+  void HandleSendCompletion(Connection& conn, int result);
+  void HandleWritableCompletion(Connection& conn);
+  void ArmAccept();
+  void CancelIo(int fd);
+  void ArmReceive(Connection& conn);
+  void ArmPoll(int fd, uint64_t tag);
+  bool ArmStatsReply(uint64_t id, int fd);
+  void ArmTick();
+  void ArmWritable(Connection& conn);
+  void ScheduleSend(Connection& conn);
+  void SubmitSends();
+  void ReleaseIfIdle(Connection& conn);
+
+  int index_;
+  ServerContext* context_;
+  int epoll_fd_;
+  int listen_fd_;
+  int wake_fd_;
+  int stats_fd_;
+  std::atomic<bool> running_;
+  std::thread thread_;
+  std::unordered_map<uint64_t, Connection> connections_;
+  ChannelIndex channels_;
+  std::vector<uint64_t> peers_;
+  std::vector<uint64_t> closing_;
+  std::chrono::steady_clock::time_point next_tick_;
+  std::chrono::steady_clock::time_point next_dump_;
+  // Set from the handoff request until the reactor resumes or exits; no
+  // socket is read or written meanwhile.
+  bool handing_off_ = false;
+
+  std::unique_ptr<Uring> uring_;
+  bool accepting_ = false;
+  std::vector<uint64_t> send_ready_;
+  __kernel_timespec tick_timeout_{};
+  __kernel_timespec send_timeout_{};
+
+  std::mutex mailbox_mutex_;
+  std::vector<PendingMessage> mailbox_;
+  std::vector<PendingPeer> pending_peers_;
+  bool handoff_requested_ = false;
+
+  std::mutex stats_mutex_;
+  std::vector<ClientStats> client_stats_;
+  // Keyed by ids drawn from the connection id counter, so they double as
+  // epoll tags.
+  std::unordered_map<uint64_t, StatsReply> stats_replies_;
+};
+
+#endif  // MEDIA_STREAM_REACTOR_H_
@@ -0,0 +1,394 @@
+// io_uring backend of Reactor. One io_uring_enter per loop iteration submits
+// every send prepared since the last one and waits for completions; accepts
+// and receives are multishot, so a busy connection costs no syscalls of its
+// own on the receive side.
+
+#include "reactor.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <iostream>
+
+#include "uring.h"
+
+namespace {
+constexpr unsigned kRingEntries = 4096;
+constexpr uint16_t kBufferGroup = 0;
+constexpr uint16_t kBufferCount = 256;
+constexpr uint32_t kReceiveBufferSize = 16 * 1024;
+// Kernel limit (UIO_MAXIOV). With one send in flight per connection, a
+// larger batch than the epoll path's keeps bursts from piling up in the queue.
+constexpr int kMaxSendIov = 1024;
+// Completions handled before queued sends are submitted. A full buffer ring
+// can hold megabytes of inbound data; handling it all first would let a burst
+// overrun outbound queues that the epoll path drains as it goes.
+constexpr unsigned kCompletionsPerPass = 32;
+// A send that has not completed by then belongs to a reader that stopped
+// draining its socket. It is cut short and the rest waits for POLLOUT, like
+// on the epoll path, so the queued messages are no longer pinned and the
+// overflow policy applies to them.
+constexpr long kSendTimeoutNs = 200 * 1000 * 1000;
+
+// user_data layout: operation in the top byte, connection id below.
+enum class Op : uint8_t {
+  kAccept = 1,
+  kReceive,
+  kSend,
+  kWake,
+  kStats,
+  kStatsReply,
+  kTick,
+  kCancel,
+  kWritable,
+};
+
+constexpr int kOpShift = 56;
+constexpr uint64_t kIdMask = (uint64_t{1} << kOpShift) - 1;
+
+uint64_t make_tag(Op op, uint64_t id = 0) {
+  return (static_cast<uint64_t>(op) << kOpShift) | (id & kIdMask);
+}
+
+Op tag_op(uint64_t tag) { return static_cast<Op>(tag >> kOpShift); }
+uint64_t tag_id(uint64_t tag) { return tag & kIdMask; }
+}  // namespace
+
+bool Reactor::InitUring() {
+  uring_ = std::make_unique<Uring>();
+  if (!uring_->Init(kRingEntries) ||
+      !uring_->SetupBufferRing(kBufferGroup, kBufferCount, kReceiveBufferSize)) {
+    std::cerr << "Reactor " << index_ << ": io_uring unavailable (needs Linux 6.0+).\n";
+    uring_.reset();
+    return false;
+  }
+  tick_timeout_.tv_sec = 1;
+  send_timeout_.tv_nsec = kSendTimeoutNs;
+  return true;
+}
+
+void Reactor::RunUring() {
+  next_tick_ = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  next_dump_ = std::chrono::steady_clock::now() +
+               std::chrono::seconds(context_->stats_interval_seconds);
+  ArmAccept();
+  ArmPoll(wake_fd_, make_tag(Op::kWake));
+  if (stats_fd_ >= 0) {
+    ArmPoll(stats_fd_, make_tag(Op::kStats));
+  }
+  ArmTick();
+  // Sends queued for connections restored from a previous process.
+  SubmitSends();
+
+  while (running_.load()) {
+    if (!uring_->Submit(uring_->HasCompletions() ? 0 : 1)) {
+      std::cerr << "Reactor " << index_ << ": io_uring_enter failed.\n";
+      break;
+    }
+    uring_->ForEachCompletion(kCompletionsPerPass,
+                              [this](const io_uring_cqe& cqe) { HandleCompletion(cqe); });
+
+    while (!closing_.empty()) {
+      uint64_t id = closing_.back();
+      closing_.pop_back();
+      CloseConnection(id);
+    }
+    if (handing_off_ && Quiesced()) {
+      HandOff();
+    }
+    SubmitSends();
+  }
+}
+
+void Reactor::HandleCompletion(const io_uring_cqe& cqe) {
+  uint64_t tag = cqe.user_data;
+  bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+  switch (tag_op(tag)) {
+    case Op::kAccept:
+      if (cqe.res >= 0) {
+        AddConnection(cqe.res);
+      } else if (cqe.res != -EAGAIN && cqe.res != -ECONNABORTED && cqe.res != -EINTR &&
+                 cqe.res != -ECANCELED) {
+        std::cerr << "Accept failed.\n";
+      }
+      if (!more) {
+        accepting_ = false;
+        if (!handing_off_) {
+          ArmAccept();
+        }
+      }
+      return;
+    case Op::kWake:
+      DrainMailbox();
+      if (!more) {
+        ArmPoll(wake_fd_, tag);
+      }
+      return;
+    case Op::kStats:
+      ServeStats();
+      if (!more) {
+        ArmPoll(stats_fd_, tag);
+      }
+      return;
+    case Op::kStatsReply:
+      WriteStatsReply(tag_id(tag));
+      return;
+    case Op::kTick:
+      if (std::chrono::steady_clock::now() >= next_tick_) {
+        Tick();
+      }
+      ArmTick();
+      return;
+    case Op::kCancel:
+      return;
+    case Op::kReceive:
+    case Op::kSend:
+    case Op::kWritable:
+      break;
+  }
+
+  auto it = connections_.find(tag_id(tag));
+  if (it == connections_.end()) {
+    return;
+  }
+  if (tag_op(tag) == Op::kReceive) {
+    HandleReceiveCompletion(it->second, cqe);
+  } else if (tag_op(tag) == Op::kWritable) {
+    HandleWritableCompletion(it->second);
+  } else {
+    HandleSendCompletion(it->second, cqe.res);
+  }
+}
+
+void Reactor::HandleReceiveCompletion(Connection& conn, const io_uring_cqe& cqe) {
+  bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+  if (!more) {
+    --conn.inflight;
+  }
+  if (cqe.flags & IORING_CQE_F_BUFFER) {
+    uint16_t buffer_id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    if (cqe.res > 0 && !conn.closing &&
+        !Receive(conn, uring_->buffer(buffer_id), static_cast<size_t>(cqe.res))) {
+      MarkClosing(conn);
+    }
+    uring_->RecycleBuffer(buffer_id);
+  }
+
+  if (conn.closed) {
+    ReleaseIfIdle(conn);
+    return;
+  }
+  if (handing_off_ && cqe.res == -ECANCELED) {
+    return;
+  }
+  if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS)) {
+    MarkClosing(conn);
+    return;
+  }
+  // Multishot receives stop when the buffer ring runs dry; re-arm.
+  if (!more && !conn.closing && !handing_off_) {
+    ArmReceive(conn);
+  }
+}
+
+void Reactor::HandleSendCompletion(Connection& conn, int result) {
+  --conn.inflight;
+  conn.sending = false;
+  size_t requested = 0;
+  for (size_t i = 0; i < conn.send_header.msg_iovlen; ++i) {
+    requested += conn.send_iov[i].iov_len;
+  }
+  FlushStats stats;
+  conn.outbound.CompleteSend(result > 0 ? static_cast<size_t>(result) : 0, &stats,
+                             &context_->metrics.fanout_latency);
+  conn.messages_out += stats.messages;
+  conn.bytes_out += stats.bytes;
+  context_->metrics.messages_out.fetch_add(stats.messages, std::memory_order_relaxed);
+  context_->metrics.bytes_out.fetch_add(stats.bytes, std::memory_order_relaxed);
+
+  if (conn.closed) {
+    ReleaseIfIdle(conn);
+    return;
+  }
+  if (handing_off_) {
+    // Cancelled; a partial send still reports the bytes written, so the rest
+    // is handed over or resent on resume.
+    return;
+  }
+  // The linked timeout fired; a partial send reports the bytes written.
+  if (result == -ECANCELED || (result >= 0 && static_cast<size_t>(result) < requested)) {
+    ArmWritable(conn);
+    return;
+  }
+  if (result < 0) {
+    std::cerr << "Failed to send to client fd " << conn.fd << '\n';
+    MarkClosing(conn);
+    return;
+  }
+  if (!conn.outbound.empty()) {
+    ScheduleSend(conn);
+  }
+}
+
+void Reactor::HandleWritableCompletion(Connection& conn) {
+  --conn.inflight;
+  conn.sending = false;
+  if (conn.closed) {
+    ReleaseIfIdle(conn);
+    return;
+  }
+  if (!handing_off_ && !conn.outbound.empty()) {
+    ScheduleSend(conn);
+  }
+}
+
+void Reactor::ArmAccept() {
+  io_uring_sqe* sqe = uring_->GetSqe();
+  if (!sqe) {
+    return;
+  }
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listen_fd_;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  // Accepted sockets stay blocking: io_uring parks a send that does not fit
+  // the socket buffer until it does, or until its linked timeout fires,
+  // instead of failing with EAGAIN.
+  sqe->accept_flags = SOCK_CLOEXEC;
+  sqe->user_data = make_tag(Op::kAccept);
+  accepting_ = true;
+}
+
+void Reactor::CancelIo(int fd) {
+  io_uring_sqe* sqe = uring_->GetSqe();
+  if (!sqe) {
+    return;
+  }
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = fd;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  sqe->user_data = make_tag(Op::kCancel);
+}
+
+void Reactor::ArmReceive(Connection& conn) {
+  io_uring_sqe* sqe = uring_->GetSqe();
+  if (!sqe) {
+    MarkClosing(conn);
+    return;
+  }
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = conn.fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kBufferGroup;
+  sqe->user_data = make_tag(Op::kReceive, conn.id);
+  ++conn.inflight;
+}
+
+void Reactor::ArmPoll(int fd, uint64_t tag) {
+  io_uring_sqe* sqe = uring_->GetSqe();
+  if (!sqe) {
+    return;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = tag;
+}
+
+bool Reactor::ArmStatsReply(uint64_t id, int fd) {
+  io_uring_sqe* sqe = uring_->GetSqe();
+  if (!sqe) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = POLLOUT;
+  sqe->user_data = make_tag(Op::kStatsReply, id);
+  return true;
+}
+
+void Reactor::ArmWritable(Connection& conn) {
+  io_uring_sqe* sqe = uring_->GetSqe();
+  if (!sqe) {
+    MarkClosing(conn);
+    return;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = conn.fd;
+  sqe->poll32_events = POLLOUT;
+  sqe->user_data = make_tag(Op::kWritable, conn.id);
+  conn.sending = true;
+  ++conn.inflight;
+}
+
+void Reactor::ArmTick() {
+  io_uring_sqe* sqe = uring_->GetSqe();
+  if (!sqe) {
+    return;
+  }
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->addr = reinterpret_cast<uint64_t>(&tick_timeout_);
+  sqe->len = 1;
+  sqe->user_data = make_tag(Op::kTick);
+}
+
+void Reactor::ScheduleSend(Connection& conn) {
+  if (!conn.send_scheduled && !conn.sending) {
+    conn.send_scheduled = true;
+    send_ready_.push_back(conn.id);
+  }
+}
+
+void Reactor::SubmitSends() {
+  for (uint64_t id : send_ready_) {
+    auto it = connections_.find(id);
+    if (it == connections_.end()) {
+      continue;
+    }
+    Connection& conn = it->second;
+    conn.send_scheduled = false;
+    if (conn.closing || conn.sending || conn.outbound.empty() || handing_off_) {
+      continue;
+    }
+    if (!uring_->Reserve(2)) {
+      MarkClosing(conn);
+      continue;
+    }
+    io_uring_sqe* sqe = uring_->GetSqe();
+    // Every queued message goes out in one SENDMSG; the iovecs stay with the
+    // connection and the messages stay pinned until it completes.
+    conn.send_iov.resize(kMaxSendIov);
+    int iov_count = conn.outbound.PrepareSend(conn.send_iov.data(), kMaxSendIov);
+    conn.send_header = msghdr{};
+    conn.send_header.msg_iov = conn.send_iov.data();
+    conn.send_header.msg_iovlen = static_cast<size_t>(iov_count);
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&conn.send_header);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = make_tag(Op::kSend, conn.id);
+    conn.sending = true;
+    ++conn.inflight;
+
+    io_uring_sqe* timeout = uring_->GetSqe();
+    timeout->opcode = IORING_OP_LINK_TIMEOUT;
+    timeout->addr = reinterpret_cast<uint64_t>(&send_timeout_);
+    timeout->len = 1;
+    timeout->user_data = make_tag(Op::kCancel);
+  }
+  send_ready_.clear();
+}
+
+void Reactor::ReleaseIfIdle(Connection& conn) {
+  if (conn.inflight > 0) {
+    return;
+  }
+  close(conn.fd);
+  connections_.erase(conn.id);
+}
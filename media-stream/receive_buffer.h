@@ -0,0 +1,67 @@
+#ifndef MEDIA_STREAM_RECEIVE_BUFFER_H_
+#define MEDIA_STREAM_RECEIVE_BUFFER_H_
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+// Growable buffer for a stream socket: recv writes straight into the free
+// tail and parsers read whole messages in place, consuming them from the
+// front. Unread bytes move back to the front only when the tail is too
+// short, so messages stay contiguous and nothing is copied per message.
+class ReceiveBuffer {
+ public:
+  // Returns room for at least `min_space` bytes after the data.
+  char* Reserve(size_t min_space) {
+    if (capacity_ - end_ < min_space) {
+      size_t size = end_ - begin_;
+      if (capacity_ - size < min_space) {
+        size_t capacity = capacity_ == 0 ? min_space : capacity_;
+        while (capacity - size < min_space) {
+          capacity *= 2;
+        }
+        std::unique_ptr<char[]> bytes(new char[capacity]);
+        if (size > 0) {
+          std::memcpy(bytes.get(), bytes_.get() + begin_, size);
+        }
+        bytes_ = std::move(bytes);
+        capacity_ = capacity;
+      } else {
+        std::memmove(bytes_.get(), bytes_.get() + begin_, size);
+      }
+      begin_ = 0;
+      end_ = size;
+    }
+    return bytes_.get() + end_;
+  }
+  // Marks `bytes` of the reserved room as filled.
+  void Commit(size_t bytes) { end_ += bytes; }
+  void Append(std::string_view bytes) {
+    std::memcpy(Reserve(bytes.size()), bytes.data(), bytes.size());
+    Commit(bytes.size());
+  }
+
+  // Valid until the next Reserve or Append.
+  std::string_view Data() const { return std::string_view(bytes_.get() + begin_, end_ - begin_); }
+  bool Empty() const { return begin_ == end_; }
+  void Consume(size_t bytes) {
+    begin_ += bytes;
+    if (begin_ == end_) {
+      begin_ = 0;
+      end_ = 0;
+    }
+  }
+  void Clear() {
+    begin_ = 0;
+    end_ = 0;
+  }
+
+ private:
+  std::unique_ptr<char[]> bytes_;
+  size_t capacity_ = 0;
+  size_t begin_ = 0;
+  size_t end_ = 0;
+};
+
+#endif  // MEDIA_STREAM_RECEIVE_BUFFER_H_
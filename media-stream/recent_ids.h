@@ -0,0 +1,38 @@
+#ifndef MEDIA_STREAM_RECENT_IDS_H_
+#define MEDIA_STREAM_RECENT_IDS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <unordered_set>
+
+// The last `capacity` message ids relayed into this server, shared by all
+// reactors. A message reaches a server once per peer link in a mesh with
+// cycles; only the first copy is fanned out.
+class RecentIds {
+ public:
+  explicit RecentIds(size_t capacity) : capacity_(capacity) {}
+
+  // Returns false if the id is already in the window.
+  bool Insert(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!ids_.insert(id).second) {
+      return false;
+    }
+    order_.push_back(id);
+    if (order_.size() > capacity_) {
+      ids_.erase(order_.front());
+      order_.pop_front();
+    }
+    return true;
+  }
+
+ private:
+  const size_t capacity_;
+  std::mutex mutex_;
+  std::unordered_set<uint64_t> ids_;
+  std::deque<uint64_t> order_;
+};
+
+#endif  // MEDIA_STREAM_RECENT_IDS_H_
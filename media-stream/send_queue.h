@@ -0,0 +1,55 @@
+#ifndef MEDIA_STREAM_SEND_QUEUE_H_
+#define MEDIA_STREAM_SEND_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Lock-free ring of encoded messages for one producer and one consumer. The
+// consumer reads messages in place and pops them once written; slots keep
+// their capacity, so pushes stop allocating once every slot has been used.
+class SendQueue {
+ public:
+  // Rounds `capacity` up to a power of two.
+  explicit SendQueue(size_t capacity) {
+    size_t slots = 1;
+    while (slots < capacity) {
+      slots <<= 1;
+    }
+    slots_.resize(slots);
+  }
+
+  // Producer. Returns false if the queue is full.
+  bool Push(std::string_view head, std::string_view body) {
+    size_t head_index = head_.load(std::memory_order_relaxed);
+    if (head_index - tail_.load(std::memory_order_acquire) == slots_.size()) {
+      return false;
+    }
+    std::string& slot = slots_[head_index & (slots_.size() - 1)];
+    slot.assign(head);
+    slot.append(body);
+    head_.store(head_index + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer.
+  size_t Size() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_relaxed);
+  }
+  // The `index`-th oldest message; index < Size().
+  const std::string& At(size_t index) const {
+    return slots_[(tail_.load(std::memory_order_relaxed) + index) & (slots_.size() - 1)];
+  }
+  void Pop(size_t count) {
+    tail_.store(tail_.load(std::memory_order_relaxed) + count, std::memory_order_release);
+  }
+
+ private:
+  std::vector<std::string> slots_;
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+};
+
+#endif  // MEDIA_STREAM_SEND_QUEUE_H_
@@ -1,125 +1,291 @@
-#include <arpa/inet.h>
-#include <netinet/in.h>
-#include <sys/socket.h>
+#include "reactor.h"
+
+#include <pthread.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <algorithm>
-#include <cstring>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
 #include <iostream>
-#include <mutex>
+#include <memory>
+#include <random>
 #include <string>
 #include <thread>
 #include <vector>
 
-namespace {
-constexpr int kBufferSize = 1024;
-
-std::vector<int> clients;
-std::mutex clients_mutex;
+#include "hot_restart.h"
+#include "message_log.h"
+#include "peer_connector.h"
 
-void remove_client(int client_fd) {
-  std::lock_guard<std::mutex> lock(clients_mutex);
-  clients.erase(std::remove(clients.begin(), clients.end(), client_fd), clients.end());
-}
+namespace {
+constexpr size_t kDefaultLogSegmentBytes = 64 * 1024 * 1024;
+// A segment must fit the largest frame; index offsets are 32-bit.
+constexpr size_t kMinLogSegmentBytes = 2 * 1024 * 1024;
+constexpr size_t kMaxLogSegmentBytes = 1024 * 1024 * 1024;
 
-void broadcast_message(const std::string& message, int sender_fd) {
-  std::lock_guard<std::mutex> lock(clients_mutex);
-  for (int fd : clients) {
-    if (fd == sender_fd) {
-      continue;
-    }
-    ssize_t sent = send(fd, message.c_str(), message.size(), 0);
-    if (sent < 0) {
-      std::cerr << "Failed to send to client fd " << fd << '\n';
-    }
+// MessageLog::Start creates the directory too; this catches what would make
+// it fail before a takeover commits.
+bool writable_directory(const std::string& path) {
+  if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+    std::cerr << "Cannot create log directory " << path << '\n';
+    return false;
   }
-}
-
-void handle_client(int client_fd, std::string client_label) {
-  char buffer[kBufferSize];
-
-  std::string join_message = client_label + " joined the chat.\n";
-  broadcast_message(join_message, client_fd);
-  std::cout << join_message;
-
-  while (true) {
-    std::memset(buffer, 0, sizeof(buffer));
-    ssize_t bytes_received = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-    if (bytes_received <= 0) {
-      break;
-    }
-    std::string text(buffer, static_cast<size_t>(bytes_received));
-    std::string outbound = client_label + ": " + text;
-    broadcast_message(outbound, client_fd);
-    std::cout << outbound;
+  if (access(path.c_str(), W_OK | X_OK) != 0) {
+    std::cerr << "Log directory " << path << " is not writable.\n";
+    return false;
   }
+  return true;
+}
 
-  close(client_fd);
-  remove_client(client_fd);
-  std::string leave_message = client_label + " left the chat.\n";
-  broadcast_message(leave_message, client_fd);
-  std::cout << leave_message;
+void print_usage(const char* program) {
+  std::cerr << "Usage: " << program
+            << " [port] [--threads N|auto] [--queue-messages N] [--queue-bytes N]"
+               " [--overflow drop-oldest|drop-newest|disconnect] [--conflate]"
+               " [--stats-port N] [--stats-interval SECONDS] [--quiet] [--io epoll|uring]"
+               " [--peer HOST:PORT]... [--accept-peer HOST]... [--log-dir DIR]"
+               " [--log-segment-bytes N]"
+               " [--client-rate MSGS] [--client-byte-rate BYTES] [--channel-rate MSGS]"
+               " [--hot-restart-socket PATH [--takeover]]\n";
 }
 }  // namespace
 
 int main(int argc, char* argv[]) {
   int port = 54000;
-  if (argc > 1) {
-    port = std::stoi(argv[1]);
-  }
+  int thread_count = 1;
+  OutboundLimits outbound_limits;
+  bool conflate = false;
+  int stats_port = 0;
+  int stats_interval_seconds = 0;
+  bool echo = true;
+  IoBackend io_backend = IoBackend::kEpoll;
+  std::vector<std::string> peers;
+  std::vector<std::string> accepted_peers;
+  std::string log_dir;
+  size_t log_segment_bytes = kDefaultLogSegmentBytes;
+  double client_message_rate = 0;
+  double client_byte_rate = 0;
+  double channel_message_rate = 0;
+  std::string hot_restart_socket;
+  bool takeover = false;
 
-  int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (server_fd < 0) {
-    std::cerr << "Socket creation failed.\n";
-    return 1;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--threads" && i + 1 < argc) {
+      std::string value = argv[++i];
+      if (value == "auto") {
+        thread_count = static_cast<int>(std::thread::hardware_concurrency());
+      } else {
+        thread_count = std::stoi(value);
+      }
+    } else if (arg == "--queue-messages" && i + 1 < argc) {
+      outbound_limits.max_messages = std::stoul(argv[++i]);
+    } else if (arg == "--queue-bytes" && i + 1 < argc) {
+      outbound_limits.max_bytes = std::stoul(argv[++i]);
+    } else if (arg == "--overflow" && i + 1 < argc) {
+      if (!parse_overflow_policy(argv[++i], &outbound_limits.policy)) {
+        print_usage(argv[0]);
+        return 1;
+      }
+    } else if (arg == "--conflate") {
+      conflate = true;
+    } else if (arg == "--stats-port" && i + 1 < argc) {
+      stats_port = std::stoi(argv[++i]);
+    } else if (arg == "--stats-interval" && i + 1 < argc) {
+      stats_interval_seconds = std::stoi(argv[++i]);
+    } else if (arg == "--quiet") {
+      echo = false;
+    } else if (arg == "--io" && i + 1 < argc) {
+      if (!parse_io_backend(argv[++i], &io_backend)) {
+        print_usage(argv[0]);
+        return 1;
+      }
+    } else if (arg == "--peer" && i + 1 < argc) {
+      peers.push_back(argv[++i]);
+    } else if (arg == "--accept-peer" && i + 1 < argc) {
+      accepted_peers.push_back(argv[++i]);
+    } else if (arg == "--client-rate" && i + 1 < argc) {
+      client_message_rate = std::stod(argv[++i]);
+    } else if (arg == "--client-byte-rate" && i + 1 < argc) {
+      client_byte_rate = std::stod(argv[++i]);
+    } else if (arg == "--channel-rate" && i + 1 < argc) {
+      channel_message_rate = std::stod(argv[++i]);
+    } else if (arg == "--hot-restart-socket" && i + 1 < argc) {
+      hot_restart_socket = argv[++i];
+    } else if (arg == "--takeover") {
+      takeover = true;
+    } else if (arg == "--log-dir" && i + 1 < argc) {
+      log_dir = argv[++i];
+    } else if (arg == "--log-segment-bytes" && i + 1 < argc) {
+      log_segment_bytes = std::clamp<size_t>(std::stoul(argv[++i]), kMinLogSegmentBytes,
+                                             kMaxLogSegmentBytes);
+    } else if (!arg.empty() && arg[0] != '-') {
+      port = std::stoi(arg);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
   }
-
-  int opt = 1;
-  if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-    std::cerr << "setsockopt(SO_REUSEADDR) failed.\n";
-    close(server_fd);
+  thread_count = std::max(1, thread_count);
+  if (takeover && hot_restart_socket.empty()) {
+    print_usage(argv[0]);
     return 1;
   }
 
-  sockaddr_in server_addr{};
-  server_addr.sin_family = AF_INET;
-  server_addr.sin_addr.s_addr = INADDR_ANY;
-  server_addr.sin_port = htons(static_cast<uint16_t>(port));
+  std::signal(SIGPIPE, SIG_IGN);
+  // SIGINT and SIGTERM are taken by a thread of their own, so every thread
+  // started from here on runs with them blocked.
+  sigset_t stop_signals;
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
 
-  if (bind(server_fd, reinterpret_cast<sockaddr*>(&server_addr), sizeof(server_addr)) < 0) {
-    std::cerr << "Bind failed on port " << port << ".\n";
-    close(server_fd);
+  ServerContext context;
+  context.outbound_limits = outbound_limits;
+  context.conflate = conflate;
+  context.echo = echo;
+  context.io_backend = io_backend;
+  context.stats_interval_seconds = std::max(0, stats_interval_seconds);
+  context.client_message_rate = client_message_rate;
+  context.client_byte_rate = client_byte_rate;
+  context.channel_limiter.SetRate(channel_message_rate);
+  // Only has to differ between the servers of one mesh.
+  std::random_device random;
+  context.server_id = std::max<uint32_t>(1, random());
+  // A takeover keeps the running server's identity, port and reactor count.
+  HandoffState handoff;
+  int handoff_link = -1;
+  if (takeover) {
+    handoff_link = HotRestart::Receive(hot_restart_socket, &handoff);
+    if (handoff_link < 0) {
+      return 1;
+    }
+    HotRestart::RestoreContext(handoff, &context);
+    port = handoff.port;
+    thread_count = static_cast<int>(handoff.listeners.size());
+  }
+  PeerConnector peer_connector(&context);
+  for (const std::string& peer : peers) {
+    if (!peer_connector.AddPeer(peer)) {
+      std::cerr << "Invalid peer address: " << peer << '\n';
+      return 1;
+    }
+  }
+  for (const std::string& host : accepted_peers) {
+    if (!peer_connector.AcceptFrom(host)) {
+      std::cerr << "Cannot resolve peer host: " << host << '\n';
+      return 1;
+    }
+  }
+  context.peer_connector = &peer_connector;
+  HotRestart hot_restart(&context);
+  context.hot_restart = &hot_restart;
+  std::unique_ptr<MessageLog> message_log;
+  std::vector<std::unique_ptr<Reactor>> reactors;
+  for (int i = 0; i < thread_count; ++i) {
+    reactors.push_back(std::make_unique<Reactor>(i, &context));
+    bool listening = takeover ? reactors.back()->AdoptListener(handoff.listeners[i])
+                              : reactors.back()->Listen(port, thread_count > 1);
+    if (!listening) {
+      // Before Commit, exiting leaves the running server to carry on.
+      return 1;
+    }
+    context.reactors.push_back(reactors.back().get());
+  }
+  // Everything that can fail is set up before Commit: after it, exiting would
+  // drop every client handed over.
+  if (!log_dir.empty() && !writable_directory(log_dir)) {
     return 1;
   }
-
-  if (listen(server_fd, 10) < 0) {
-    std::cerr << "Listen failed.\n";
-    close(server_fd);
+  if (!hot_restart_socket.empty() && !hot_restart.Listen(hot_restart_socket, takeover)) {
     return 1;
   }
-
-  std::cout << "Server listening on port " << port << '\n';
-
-  int client_counter = 1;
-  while (true) {
-    sockaddr_in client_addr{};
-    socklen_t client_len = sizeof(client_addr);
-    int client_fd = accept(server_fd, reinterpret_cast<sockaddr*>(&client_addr), &client_len);
-    if (client_fd < 0) {
-      std::cerr << "Accept failed.\n";
-      continue;
+  if (handoff.stats_listener >= 0 && handoff.stats_port != stats_port) {
+    close(handoff.stats_listener);
+    handoff.stats_listener = -1;
+  }
+  if (stats_port > 0) {
+    bool serving = handoff.stats_listener >= 0
+                       ? reactors.front()->AdoptStatsListener(handoff.stats_listener)
+                       : reactors.front()->ListenStats(stats_port);
+    if (!serving) {
+      return 1;
     }
-
-    std::string label = "Client" + std::to_string(client_counter++);
-    {
-      std::lock_guard<std::mutex> lock(clients_mutex);
-      clients.push_back(client_fd);
+  }
+  if (takeover) {
+    // Nothing may touch a client socket before the old process has let go.
+    if (!HotRestart::Commit(handoff_link)) {
+      return 1;
     }
+    hot_restart.Publish();
+    size_t restored = 0;
+    for (HandoffConnection& connection : handoff.connections) {
+      if (reactors[connection.reactor]->Restore(std::move(connection))) {
+        ++restored;
+      }
+    }
+    std::cout << "Took over " << restored << " connection(s) from the previous server process\n";
+  }
+  // Opened only now so that a replaced server has flushed its segments.
+  if (!log_dir.empty()) {
+    message_log = std::make_unique<MessageLog>(log_dir, log_segment_bytes);
+    if (message_log->Start()) {
+      context.message_log = message_log.get();
+    } else if (takeover) {
+      std::cerr << "Serving the handed-over clients without a message log.\n";
+      message_log.reset();
+    } else {
+      return 1;
+    }
+  }
 
-    std::thread client_thread(handle_client, client_fd, label);
-    client_thread.detach();
+  std::cout << "Server listening on port " << port << " with " << thread_count
+            << " reactor thread(s) using "
+            << (io_backend == IoBackend::kUring ? "io_uring" : "epoll") << '\n';
+  if (stats_port > 0) {
+    std::cout << "Stats available on 127.0.0.1:" << stats_port << '\n';
+  }
+
+  if (message_log) {
+    std::cout << "Logging channels to " << log_dir << '\n';
+  }
+  if (!peer_connector.empty()) {
+    std::cout << "Relaying to " << peers.size() << " peer(s) as server " << context.server_id
+              << '\n';
   }
 
-  close(server_fd);
+  for (auto& reactor : reactors) {
+    reactor->Start();
+  }
+  peer_connector.Start();
+  hot_restart.Start();
+  // Stops the server cleanly so the message log trims its segments.
+  std::atomic<bool> exiting{false};
+  std::thread signal_thread([&] {
+    int signal = 0;
+    sigwait(&stop_signals, &signal);
+    if (exiting.load()) {
+      return;
+    }
+    std::cout << "Shutting down...\n";
+    hot_restart.Stop();
+    peer_connector.Stop();
+    for (auto& reactor : reactors) {
+      reactor->Stop();
+    }
+  });
+  for (auto& reactor : reactors) {
+    reactor->Join();
+  }
+  // After a hot restart handed the clients over, the signal thread is still
+  // waiting.
+  exiting.store(true);
+  pthread_kill(signal_thread.native_handle(), SIGTERM);
+  signal_thread.join();
+  if (message_log) {
+    message_log->Stop();
+  }
   return 0;
 }
@@ -0,0 +1,88 @@
+#include "server_metrics.h"
+
+#include <iomanip>
+#include <sstream>
+
+ServerMetrics::Totals ServerMetrics::Load() const {
+  Totals totals;
+  totals.messages_in = messages_in.load(std::memory_order_relaxed);
+  totals.bytes_in = bytes_in.load(std::memory_order_relaxed);
+  totals.messages_out = messages_out.load(std::memory_order_relaxed);
+  totals.bytes_out = bytes_out.load(std::memory_order_relaxed);
+  return totals;
+}
+
+void ServerMetrics::Sample() {
+  auto now = std::chrono::steady_clock::now();
+  Totals totals = Load();
+
+  std::lock_guard<std::mutex> lock(rate_mutex_);
+  double seconds = std::chrono::duration<double>(now - last_sample_time_).count();
+  if (seconds <= 0.0) {
+    return;
+  }
+  rate_messages_in_ = (totals.messages_in - last_sample_.messages_in) / seconds;
+  rate_bytes_in_ = (totals.bytes_in - last_sample_.bytes_in) / seconds;
+  rate_messages_out_ = (totals.messages_out - last_sample_.messages_out) / seconds;
+  rate_bytes_out_ = (totals.bytes_out - last_sample_.bytes_out) / seconds;
+  last_sample_ = totals;
+  last_sample_time_ = now;
+}
+
+std::string ServerMetrics::Render(const std::vector<ClientStats>& clients,
+                                  const std::vector<Session>& sessions) const {
+  Totals totals = Load();
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1);
+  out << "connections " << connections.load() << '\n'
+      << "accepted_total " << accepted.load() << '\n'
+      << "messages_in_total " << totals.messages_in << '\n'
+      << "bytes_in_total " << totals.bytes_in << '\n'
+      << "messages_out_total " << totals.messages_out << '\n'
+      << "bytes_out_total " << totals.bytes_out << '\n'
+      << "dropped_total " << dropped.load() << '\n'
+      << "conflated_total " << conflated.load() << '\n'
+      << "overflow_disconnects_total " << overflow_disconnects.load() << '\n'
+      << "rate_limited_total " << rate_limited.load() << '\n'
+      << "backpressure_signals_total " << backpressure_signals.load() << '\n'
+      << "relayed_total " << relayed.load() << '\n'
+      << "relay_duplicates_total " << relay_duplicates.load() << '\n';
+  {
+    std::lock_guard<std::mutex> lock(rate_mutex_);
+    out << "messages_in_per_sec " << rate_messages_in_ << '\n'
+        << "bytes_in_per_sec " << rate_bytes_in_ << '\n'
+        << "messages_out_per_sec " << rate_messages_out_ << '\n'
+        << "bytes_out_per_sec " << rate_bytes_out_ << '\n';
+  }
+
+  out << "fanout_latency_count " << fanout_latency.Count() << '\n'
+      << "fanout_latency_p50_us " << fanout_latency.PercentileMicros(0.50) << '\n'
+      << "fanout_latency_p99_us " << fanout_latency.PercentileMicros(0.99) << '\n'
+      << "fanout_latency_p999_us " << fanout_latency.PercentileMicros(0.999) << '\n';
+  for (int i = 0; i < LatencyHistogram::kBuckets; ++i) {
+    uint64_t count = fanout_latency.BucketCount(i);
+    if (count > 0) {
+      out << "fanout_latency_bucket{le_us=\"" << LatencyHistogram::BucketLimitMicros(i) << "\"} "
+          << count << '\n';
+    }
+  }
+
+  out << "# session handle name role state\n";
+  for (const Session& session : sessions) {
+    out << "session " << session.handle << ' ' << session.name << ' '
+        << client_role_name(session.role) << ' '
+        << (session.connection_id != 0 ? "online" : "offline") << '\n';
+  }
+
+  out << "# client handle label role format channels queue_messages queue_bytes dropped"
+         " conflated rate_limited messages_in bytes_in messages_out bytes_out\n";
+  for (const ClientStats& client : clients) {
+    out << "client " << client.id << ' ' << client.handle << ' ' << client.label << ' '
+        << client_role_name(client.role) << ' ' << wire_format_name(client.format) << ' '
+        << client.channels << ' ' << client.queue_messages << ' ' << client.queue_bytes << ' '
+        << client.dropped << ' ' << client.conflated << ' ' << client.rate_limited << ' '
+        << client.messages_in << ' ' << client.bytes_in << ' ' << client.messages_out << ' '
+        << client.bytes_out << '\n';
+  }
+  return out.str();
+}
@@ -0,0 +1,79 @@
+#ifndef MEDIA_STREAM_SERVER_METRICS_H_
+#define MEDIA_STREAM_SERVER_METRICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "frame.h"
+#include "latency_histogram.h"
+#include "session_registry.h"
+
+struct ClientStats {
+  uint64_t id = 0;
+  uint32_t handle = 0;
+  std::string label;
+  ClientRole role = ClientRole::kNone;
+  WireFormat format = WireFormat::kText;
+  size_t channels = 0;
+  size_t queue_messages = 0;
+  size_t queue_bytes = 0;
+  uint64_t dropped = 0;
+  uint64_t conflated = 0;
+  uint64_t rate_limited = 0;
+  uint64_t messages_in = 0;
+  uint64_t bytes_in = 0;
+  uint64_t messages_out = 0;
+  uint64_t bytes_out = 0;
+};
+
+// Process-wide counters updated by every reactor. Per-second rates are derived
+// by Sample(), which the first reactor calls once per stats tick.
+class ServerMetrics {
+ public:
+  std::atomic<int64_t> connections{0};
+  std::atomic<uint64_t> accepted{0};
+  std::atomic<uint64_t> messages_in{0};
+  std::atomic<uint64_t> bytes_in{0};
+  std::atomic<uint64_t> messages_out{0};
+  std::atomic<uint64_t> bytes_out{0};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<uint64_t> conflated{0};
+  std::atomic<uint64_t> overflow_disconnects{0};
+  // Publishes refused by a rate limit, and backpressure frames sent.
+  std::atomic<uint64_t> rate_limited{0};
+  std::atomic<uint64_t> backpressure_signals{0};
+  // Messages accepted from relay peers, and copies dropped as already seen.
+  std::atomic<uint64_t> relayed{0};
+  std::atomic<uint64_t> relay_duplicates{0};
+  // Time from a message entering the server to its last byte being accepted
+  // by a recipient's socket.
+  LatencyHistogram fanout_latency;
+
+  void Sample();
+  std::string Render(const std::vector<ClientStats>& clients,
+                     const std::vector<Session>& sessions) const;
+
+ private:
+  struct Totals {
+    uint64_t messages_in = 0;
+    uint64_t bytes_in = 0;
+    uint64_t messages_out = 0;
+    uint64_t bytes_out = 0;
+  };
+
+  Totals Load() const;
+
+  mutable std::mutex rate_mutex_;
+  std::chrono::steady_clock::time_point last_sample_time_ = std::chrono::steady_clock::now();
+  Totals last_sample_;
+  double rate_messages_in_ = 0.0;
+  double rate_bytes_in_ = 0.0;
+  double rate_messages_out_ = 0.0;
+  double rate_bytes_out_ = 0.0;
+};
+
+#endif  // MEDIA_STREAM_SERVER_METRICS_H_
@@ -0,0 +1,93 @@
+#ifndef MEDIA_STREAM_SESSION_REGISTRY_H_
+#define MEDIA_STREAM_SESSION_REGISTRY_H_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "frame.h"
+
+struct Session {
+  uint32_t handle = 0;
+  std::string name;
+  ClientRole role = ClientRole::kNone;
+  // Connection currently bound to the session; 0 while offline.
+  uint64_t connection_id = 0;
+};
+
+// Registered client names and the compact handles they are known by, shared
+// by all reactors. A name keeps its handle for the life of the process, so
+// anything keyed on sender_id survives a reconnect. Handles come from the
+// same counter as connection ids and never collide with anonymous senders.
+class SessionRegistry {
+ public:
+  explicit SessionRegistry(std::atomic<uint64_t>* next_handle) : next_handle_(next_handle) {}
+
+  // Binds `name` to the connection and stores the session's handle in
+  // `handle`. Fails while another connection holds the name; it becomes
+  // free again once that connection is detached.
+  bool Attach(std::string_view name, ClientRole role, uint64_t connection_id,
+              uint32_t* handle) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = handles_.find(std::string(name));
+    if (it != handles_.end()) {
+      uint64_t holder = sessions_[it->second].connection_id;
+      if (holder != 0 && holder != connection_id) {
+        return false;
+      }
+      *handle = it->second;
+    } else {
+      *handle = static_cast<uint32_t>(next_handle_->fetch_add(1));
+      handles_.emplace(std::string(name), *handle);
+    }
+    Session& session = sessions_[*handle];
+    session.handle = *handle;
+    session.name = std::string(name);
+    session.role = role;
+    session.connection_id = connection_id;
+    return true;
+  }
+
+  // Marks the session offline if `connection_id` still holds it.
+  void Detach(uint32_t handle, uint64_t connection_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sessions_.find(handle);
+    if (it != sessions_.end() && it->second.connection_id == connection_id) {
+      it->second.connection_id = 0;
+    }
+  }
+
+  // Replaces every session, e.g. with those handed over by the previous server
+  // process on a hot restart.
+  void Restore(const std::vector<Session>& sessions) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    handles_.clear();
+    sessions_.clear();
+    for (const Session& session : sessions) {
+      handles_.emplace(session.name, session.handle);
+      sessions_.emplace(session.handle, session);
+    }
+  }
+
+  std::vector<Session> Snapshot() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Session> sessions;
+    sessions.reserve(sessions_.size());
+    for (const auto& entry : sessions_) {
+      sessions.push_back(entry.second);
+    }
+    return sessions;
+  }
+
+ private:
+  std::atomic<uint64_t>* next_handle_;
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, uint32_t> handles_;
+  std::unordered_map<uint32_t, Session> sessions_;
+};
+
+#endif  // MEDIA_STREAM_SESSION_REGISTRY_H_
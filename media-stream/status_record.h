@@ -0,0 +1,152 @@
+#ifndef MEDIA_STREAM_STATUS_RECORD_H_
+#define MEDIA_STREAM_STATUS_RECORD_H_
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+#include "frame.h"
+
+// Fixed-layout [VIDEO_STATUS] record carried in FrameType::kStatus payloads.
+// Encoding and decoding touch only the caller's buffer; the key=value text
+// line is kept for debugging and for text-protocol recipients.
+//
+//   0: u8 version | 1: u8 state | 2: u8 flags | 3: u8 reserved
+//   4: u32 file_id | 8: u32 fps_milli | 12: u16 window_w | 14: u16 window_h
+//  16: i64 sent_epoch_ms | 24: i64 sync_anchor_epoch_ms | 32: i64 playhead_ms
+//  40: i64 duration_ms | 48: i64 pts | 56: i64 frame_index | 64: u64 decoded_frames
+
+enum class PlaybackState : uint8_t {
+  kPlaying = 0,
+  kPaused = 1,
+  kSeeking = 2,
+  kEof = 3,
+  kClosed = 4,
+};
+
+constexpr std::string_view kStatusLinePrefix = "[VIDEO_STATUS]";
+constexpr uint8_t kStatusRecordVersion = 1;
+constexpr size_t kStatusRecordSize = 72;
+constexpr uint8_t kStatusFlagPaused = 1 << 0;
+constexpr uint8_t kStatusFlagEof = 1 << 1;
+
+struct StatusRecord {
+  PlaybackState state = PlaybackState::kPlaying;
+  uint8_t flags = 0;
+  uint32_t file_id = 0;
+  uint32_t fps_milli = 0;
+  uint16_t window_w = 0;
+  uint16_t window_h = 0;
+  int64_t sent_epoch_ms = 0;
+  int64_t sync_anchor_epoch_ms = 0;
+  int64_t playhead_ms = 0;
+  int64_t duration_ms = 0;
+  int64_t pts = 0;
+  int64_t frame_index = 0;
+  uint64_t decoded_frames = 0;
+
+  bool paused() const { return (flags & kStatusFlagPaused) != 0; }
+  bool eof() const { return (flags & kStatusFlagEof) != 0; }
+};
+
+inline const char* playback_state_name(PlaybackState state) {
+  switch (state) {
+    case PlaybackState::kPlaying:
+      return "playing";
+    case PlaybackState::kPaused:
+      return "paused";
+    case PlaybackState::kSeeking:
+      return "seeking";
+    case PlaybackState::kEof:
+      return "eof";
+    case PlaybackState::kClosed:
+      return "closed";
+  }
+  return "unknown";
+}
+
+inline bool parse_playback_state(std::string_view name, PlaybackState* out) {
+  for (uint8_t i = 0; i <= static_cast<uint8_t>(PlaybackState::kClosed); ++i) {
+    PlaybackState state = static_cast<PlaybackState>(i);
+    if (name == playback_state_name(state)) {
+      *out = state;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline void encode_status_record(const StatusRecord& record, uint8_t* out) {
+  out[0] = kStatusRecordVersion;
+  out[1] = static_cast<uint8_t>(record.state);
+  out[2] = record.flags;
+  out[3] = 0;
+  put_u32(out + 4, record.file_id);
+  put_u32(out + 8, record.fps_milli);
+  put_u16(out + 12, record.window_w);
+  put_u16(out + 14, record.window_h);
+  put_u64(out + 16, static_cast<uint64_t>(record.sent_epoch_ms));
+  put_u64(out + 24, static_cast<uint64_t>(record.sync_anchor_epoch_ms));
+  put_u64(out + 32, static_cast<uint64_t>(record.playhead_ms));
+  put_u64(out + 40, static_cast<uint64_t>(record.duration_ms));
+  put_u64(out + 48, static_cast<uint64_t>(record.pts));
+  put_u64(out + 56, static_cast<uint64_t>(record.frame_index));
+  put_u64(out + 64, record.decoded_frames);
+}
+
+// Returns false if the payload is too short or from an unknown version.
+// Longer payloads are accepted so later versions can append fields.
+inline bool decode_status_record(std::string_view payload, StatusRecord* out) {
+  if (payload.size() < kStatusRecordSize) {
+    return false;
+  }
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(payload.data());
+  if (in[0] != kStatusRecordVersion || in[1] > static_cast<uint8_t>(PlaybackState::kClosed)) {
+    return false;
+  }
+  out->state = static_cast<PlaybackState>(in[1]);
+  out->flags = in[2];
+  out->file_id = get_u32(in + 4);
+  out->fps_milli = get_u32(in + 8);
+  out->window_w = get_u16(in + 12);
+  out->window_h = get_u16(in + 14);
+  out->sent_epoch_ms = static_cast<int64_t>(get_u64(in + 16));
+  out->sync_anchor_epoch_ms = static_cast<int64_t>(get_u64(in + 24));
+  out->playhead_ms = static_cast<int64_t>(get_u64(in + 32));
+  out->duration_ms = static_cast<int64_t>(get_u64(in + 40));
+  out->pts = static_cast<int64_t>(get_u64(in + 48));
+  out->frame_index = static_cast<int64_t>(get_u64(in + 56));
+  out->decoded_frames = get_u64(in + 64);
+  return true;
+}
+
+constexpr size_t kStatusTextSize = 512;
+
+// Debug rendering of a binary record as a key=value [VIDEO_STATUS] line,
+// written to `line` (kStatusTextSize bytes). Returns its length.
+inline size_t format_status_text(const StatusRecord& record, char* line) {
+  int length = std::snprintf(
+      line, kStatusTextSize,
+      "%s file_id=%08" PRIx32 " state=%s paused=%s eof=%s fps=%.2f window=%ux%u"
+      " sent_epoch_ms=%" PRId64 " sync_anchor_epoch_ms=%" PRId64 " playhead_ms=%" PRId64
+      " duration_ms=%" PRId64 " frame_index=%" PRId64 " decoded_frames=%" PRIu64 " pts=%" PRId64,
+      kStatusLinePrefix.data(), record.file_id, playback_state_name(record.state), record.paused() ? "yes" : "no",
+      record.eof() ? "yes" : "no", record.fps_milli / 1000.0, record.window_w, record.window_h,
+      record.sent_epoch_ms, record.sync_anchor_epoch_ms, record.playhead_ms, record.duration_ms,
+      record.frame_index, record.decoded_frames, record.pts);
+  if (length < 0) {
+    return 0;
+  }
+  return std::min(static_cast<size_t>(length), kStatusTextSize - 1);
+}
+
+inline std::string format_status_text(const StatusRecord& record) {
+  char line[kStatusTextSize];
+  return std::string(line, format_status_text(record, line));
+}
+
+#endif  // MEDIA_STREAM_STATUS_RECORD_H_
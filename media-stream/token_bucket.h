@@ -0,0 +1,44 @@
+#ifndef MEDIA_STREAM_TOKEN_BUCKET_H_
+#define MEDIA_STREAM_TOKEN_BUCKET_H_
+
+#include <algorithm>
+#include <cstdint>
+
+// Classic token bucket holding at most one second's worth of tokens. A rate
+// of 0 admits everything. A full bucket admits one request larger than the
+// burst and goes into debt, so oversized frames are slowed, not banned.
+class TokenBucket {
+ public:
+  TokenBucket() = default;
+  explicit TokenBucket(double rate_per_second)
+      : rate_(rate_per_second), tokens_(rate_per_second) {}
+
+  bool TryTake(double amount, int64_t now_ns) {
+    if (rate_ <= 0) {
+      return true;
+    }
+    if (last_ns_ != 0) {
+      tokens_ = std::min(rate_, tokens_ + static_cast<double>(now_ns - last_ns_) * rate_ / 1e9);
+    }
+    last_ns_ = now_ns;
+    if (tokens_ < std::min(amount, rate_)) {
+      return false;
+    }
+    tokens_ -= amount;
+    return true;
+  }
+
+  // True once the bucket has refilled completely, so it is no different from
+  // a new one.
+  bool Full(int64_t now_ns) const {
+    return rate_ <= 0 || last_ns_ == 0 ||
+           tokens_ + static_cast<double>(now_ns - last_ns_) * rate_ / 1e9 >= rate_;
+  }
+
+ private:
+  double rate_ = 0;
+  double tokens_ = 0;
+  int64_t last_ns_ = 0;
+};
+
+#endif  // MEDIA_STREAM_TOKEN_BUCKET_H_
@@ -0,0 +1,168 @@
+#include "uring.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace {
+int io_uring_setup(unsigned entries, io_uring_params* params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return static_cast<int>(
+      syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+  return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+void* map_ring(int fd, size_t size, off_t offset) {
+  void* ring = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+  return ring == MAP_FAILED ? nullptr : ring;
+}
+}  // namespace
+
+Uring::~Uring() {
+  if (buffers_) munmap(buffers_, buffers_size_);
+  if (buf_ring_) munmap(buf_ring_, buf_ring_size_);
+  if (sqes_) munmap(sqes_, sqes_size_);
+  if (ring_) munmap(ring_, ring_size_);
+  if (fd_ >= 0) close(fd_);
+}
+
+bool Uring::Init(unsigned entries) {
+  io_uring_params params{};
+  params.flags = IORING_SETUP_COOP_TASKRUN;
+  fd_ = io_uring_setup(entries, &params);
+  if (fd_ < 0 && errno == EINVAL) {
+    params = io_uring_params{};
+    fd_ = io_uring_setup(entries, &params);
+  }
+  if (fd_ < 0) {
+    return false;
+  }
+  // Both rings share one mapping and completions are never dropped on
+  // overflow; multishot accept/recv and buffer rings are probed when first
+  // used.
+  const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_FAST_POLL;
+  if ((params.features & required) != required) {
+    return false;
+  }
+
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  ring_size_ = sq_size > cq_size ? sq_size : cq_size;
+  ring_ = map_ring(fd_, ring_size_, IORING_OFF_SQ_RING);
+  if (!ring_) {
+    return false;
+  }
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_ = static_cast<io_uring_sqe*>(map_ring(fd_, sqes_size_, IORING_OFF_SQES));
+  if (!sqes_) {
+    return false;
+  }
+
+  char* base = static_cast<char*>(ring_);
+  sq_head_ = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+  sq_array_ = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+  sq_mask_ = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+  sq_entries_ = params.sq_entries;
+  sq_local_tail_ = *sq_tail_;
+
+  cq_head_ = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+  return true;
+}
+
+bool Uring::SetupBufferRing(uint16_t group, uint16_t count, uint32_t buffer_size) {
+  // The kernel requires a power-of-two ring.
+  if (count == 0 || (count & (count - 1)) != 0) {
+    return false;
+  }
+  buf_ring_size_ = count * sizeof(io_uring_buf);
+  void* ring = mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                    -1, 0);
+  if (ring == MAP_FAILED) {
+    return false;
+  }
+  buf_ring_ = static_cast<io_uring_buf_ring*>(ring);
+
+  buffer_size_ = buffer_size;
+  buffers_size_ = static_cast<size_t>(count) * buffer_size;
+  void* buffers = mmap(nullptr, buffers_size_, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffers == MAP_FAILED) {
+    return false;
+  }
+  buffers_ = static_cast<char*>(buffers);
+
+  io_uring_buf_reg reg{};
+  reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+  reg.ring_entries = count;
+  reg.bgid = group;
+  if (io_uring_register(fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    return false;
+  }
+
+  buf_mask_ = static_cast<uint16_t>(count - 1);
+  buf_tail_ = 0;
+  for (uint16_t id = 0; id < count; ++id) {
+    RecycleBuffer(id);
+  }
+  return true;
+}
+
+void Uring::RecycleBuffer(uint16_t id) {
+  // Index the entries directly: compiled as C++, the header's flexible
+  // `bufs` member lands 8 bytes into the ring instead of at its start.
+  io_uring_buf* buf = reinterpret_cast<io_uring_buf*>(buf_ring_) + (buf_tail_ & buf_mask_);
+  buf->addr = reinterpret_cast<uint64_t>(buffers_ + static_cast<size_t>(id) * buffer_size_);
+  buf->len = buffer_size_;
+  buf->bid = id;
+  ++buf_tail_;
+  __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+}
+
+io_uring_sqe* Uring::GetSqe() {
+  unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (sq_local_tail_ - head >= sq_entries_) {
+    Submit(0);
+    head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sq_local_tail_ - head >= sq_entries_) {
+      return nullptr;
+    }
+  }
+  unsigned index = sq_local_tail_ & sq_mask_;
+  io_uring_sqe* sqe = &sqes_[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sq_array_[index] = index;
+  ++sq_local_tail_;
+  return sqe;
+}
+
+bool Uring::Reserve(unsigned count) {
+  if (sq_entries_ - (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE)) >= count) {
+    return true;
+  }
+  Submit(0);
+  return sq_entries_ - (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE)) >= count;
+}
+
+bool Uring::Submit(unsigned wait_nr) {
+  __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+  unsigned to_submit = sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+  if (io_uring_enter(fd_, to_submit, wait_nr, flags) >= 0) {
+    return true;
+  }
+  // EBUSY/EAGAIN: completions must be reaped before more can be submitted.
+  return errno == EINTR || errno == EBUSY || errno == EAGAIN;
+}
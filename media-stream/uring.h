@@ -0,0 +1,81 @@
+#ifndef MEDIA_STREAM_URING_H_
+#define MEDIA_STREAM_URING_H_
+
+#include <linux/io_uring.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// Minimal io_uring wrapper over the raw syscalls: one submission/completion
+// ring pair plus one provided-buffer ring for multishot receives. Not
+// thread-safe; every call must come from the thread that runs the ring.
+class Uring {
+ public:
+  Uring() = default;
+  ~Uring();
+  Uring(const Uring&) = delete;
+  Uring& operator=(const Uring&) = delete;
+
+  // Returns false if the kernel lacks io_uring or a feature the server needs.
+  bool Init(unsigned entries);
+  bool SetupBufferRing(uint16_t group, uint16_t count, uint32_t buffer_size);
+
+  // Returns a zeroed SQE, submitting queued ones first if the ring is full.
+  io_uring_sqe* GetSqe();
+  // Makes room for `count` SQEs without an intervening submit, as a linked
+  // chain needs. Returns false if the ring cannot take them.
+  bool Reserve(unsigned count);
+  // Submits every queued SQE and waits for at least `wait_nr` completions.
+  bool Submit(unsigned wait_nr);
+
+  bool HasCompletions() const {
+    return *cq_head_ != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  }
+
+  // Calls handler(const io_uring_cqe&) for up to `max` available completions.
+  template <typename Handler>
+  void ForEachCompletion(unsigned max, Handler&& handler) {
+    unsigned head = *cq_head_;
+    for (unsigned i = 0; i < max && head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE); ++i) {
+      io_uring_cqe cqe = cqes_[head & cq_mask_];
+      ++head;
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+      handler(cqe);
+    }
+  }
+
+  const char* buffer(uint16_t id) const {
+    return buffers_ + static_cast<size_t>(id) * buffer_size_;
+  }
+  // Hands a provided buffer back to the kernel once its data was consumed.
+  void RecycleBuffer(uint16_t id);
+
+ private:
+  int fd_ = -1;
+  void* ring_ = nullptr;
+  size_t ring_size_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned sq_entries_ = 0;
+  unsigned sq_local_tail_ = 0;
+
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+
+  io_uring_buf_ring* buf_ring_ = nullptr;
+  size_t buf_ring_size_ = 0;
+  char* buffers_ = nullptr;
+  size_t buffers_size_ = 0;
+  uint32_t buffer_size_ = 0;
+  uint16_t buf_mask_ = 0;
+  uint16_t buf_tail_ = 0;
+};
+
+#endif  // MEDIA_STREAM_URING_H_
@@ -1,5 +1,7 @@
 #include <SDL2/SDL.h>
 #include "../media-stream/chat_client.h"
+#include "../media-stream/latency_histogram.h"
+#include "../media-stream/status_record.h"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -9,14 +11,21 @@ extern "C" {
 }
 
 #include <algorithm>
+#include <charconv>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
 #include <iomanip>
 #include <iostream>
 #include <mutex>
 #include <optional>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 namespace {
 constexpr int kControlHeight = 90;
@@ -28,7 +37,31 @@ constexpr Uint32 kStatusSendIntervalMs = 1000;
 constexpr Uint32 kSeekActionIntervalMs = 120;
 constexpr Uint32 kRemoteSeekApplyIntervalMs = 120;
 constexpr double kSeekActionMinDeltaSeconds = 0.20;
-constexpr double kSyncDriftThresholdSeconds = 0.50;
+// Followers within kSyncDeadbandSeconds of the leader are left alone; drift up to
+// the seek threshold is closed by playing at most kSyncMaxRateAdjust faster
+// or slower, and only larger jumps are seeked.
+constexpr double kSyncDeadbandSeconds = 0.02;
+constexpr double kSyncRateGain = 0.5;
+constexpr double kSyncMaxRateAdjust = 0.05;
+constexpr double kSyncSeekThresholdSeconds = 1.5;
+// A leader silent for longer has stopped or gone away.
+constexpr int64_t kSyncReferenceMaxAgeMs = 3000;
+// The render loop wakes at least this often to handle input.
+constexpr auto kMaxFrameWait = std::chrono::milliseconds(10);
+constexpr auto kDecoderPollWait = std::chrono::milliseconds(2);
+// A timestamp this far from the previous frame's is a discontinuity, not a
+// frame to wait for or to drop everything up to.
+constexpr double kMaxFrameGapSeconds = 5.0;
+// Decoded frames buffered ahead of presentation.
+constexpr size_t kDecodeQueueFrames = 8;
+// Automatic decoder threads: one per this many pixels of picture (2 for 720p,
+// 4 for 1080p, 16 for 4K), up to the core count and FFmpeg's own limit.
+constexpr int64_t kDecodePixelsPerThread = 960 * 540;
+constexpr int kMaxDecodeThreads = 16;
+// Clock probes go out in a quick burst after each connect, then steadily.
+constexpr int kClockProbeBurst = 8;
+constexpr Uint32 kClockProbeBurstIntervalMs = 50;
+constexpr Uint32 kClockProbeIntervalMs = 1000;
 
 struct PlayerContext {
   AVFormatContext* format_ctx = nullptr;
@@ -49,6 +82,23 @@ struct PlayerContext {
   bool use_yuv420_texture = false;
 };
 
+// How the codec splits decoding across threads. Frame threading decodes
+// several frames at once, adding a frame of delay per thread, which the
+// decode queue hides; slice threading splits each frame and only helps when
+// the encoder wrote several slices. kAuto uses frame threading where the
+// codec supports it and slice threading otherwise.
+enum class DecodeThreading {
+  kAuto,
+  kFrame,
+  kSlice,
+};
+
+struct DecodeThreadConfig {
+  // 0 sizes by core count and resolution.
+  int threads = 0;
+  DecodeThreading threading = DecodeThreading::kAuto;
+};
+
 struct UiLayout {
   SDL_Rect video_dst;
   SDL_Rect controls;
@@ -57,9 +107,14 @@ struct UiLayout {
   SDL_Rect seek_bar;
 };
 
+enum class StatusFormat {
+  kBinary,
+  kText,
+};
+
 struct SyncStateSnapshot {
-  std::string file_name;
-  std::string state;
+  uint32_t file_id = 0;
+  PlaybackState state = PlaybackState::kPlaying;
   bool paused = false;
   int64_t sent_epoch_ms = 0;
   int64_t playhead_ms = 0;
@@ -77,22 +132,22 @@ std::string basename_of(const std::string& path) {
   return path.substr(pos + 1);
 }
 
-std::optional<std::string> get_kv_value(const std::string& line, const std::string& key) {
+std::optional<std::string> get_kv_value(std::string_view line, const std::string& key) {
   std::string token = key + "=";
   size_t begin = line.find(token);
-  if (begin == std::string::npos) {
+  if (begin == std::string_view::npos) {
     return std::nullopt;
   }
   begin += token.size();
   size_t end = line.find_first_of(" \r\n", begin);
-  if (end == std::string::npos) {
+  if (end == std::string_view::npos) {
     end = line.size();
   }
-  return line.substr(begin, end - begin);
+  return std::string(line.substr(begin, end - begin));
 }
 
-std::optional<SyncStateSnapshot> parse_sync_line(const std::string& line) {
-  if (line.find("[VIDEO_STATUS]") == std::string::npos) {
+std::optional<SyncStateSnapshot> parse_sync_line(std::string_view line) {
+  if (line.find("[VIDEO_STATUS]") == std::string_view::npos) {
     return std::nullopt;
   }
 
@@ -106,8 +161,10 @@ std::optional<SyncStateSnapshot> parse_sync_line(const std::string& line) {
   }
 
   SyncStateSnapshot snapshot;
-  snapshot.file_name = *file_name;
-  snapshot.state = *state;
+  snapshot.file_id = hash_name(*file_name);
+  if (!parse_playback_state(*state, &snapshot.state)) {
+    return std::nullopt;
+  }
   snapshot.paused = (*paused == "yes");
   try {
     snapshot.sent_epoch_ms = std::stoll(*sent_epoch_ms);
@@ -118,19 +175,101 @@ std::optional<SyncStateSnapshot> parse_sync_line(const std::string& line) {
   return snapshot;
 }
 
-double frame_seconds(const PlayerContext& ctx) {
-  int64_t ts = ctx.frame->best_effort_timestamp;
-  if (ts == AV_NOPTS_VALUE) {
-    ts = ctx.frame->pts;
+std::optional<SyncStateSnapshot> parse_sync_frame(const FrameView& frame) {
+  if (frame.header.type == FrameType::kData) {
+    return parse_sync_line(frame.payload);
+  }
+  StatusRecord record;
+  if (frame.header.type != FrameType::kStatus || !decode_status_record(frame.payload, &record)) {
+    return std::nullopt;
   }
+  SyncStateSnapshot snapshot;
+  snapshot.file_id = record.file_id;
+  snapshot.state = record.state;
+  snapshot.paused = record.paused();
+  snapshot.sent_epoch_ms = record.sent_epoch_ms;
+  snapshot.playhead_ms = record.playhead_ms;
+  return snapshot;
+}
+
+int64_t frame_pts(const AVFrame* frame) {
+  return frame->best_effort_timestamp != AV_NOPTS_VALUE ? frame->best_effort_timestamp : frame->pts;
+}
+
+// `fallback` for frames without a timestamp.
+double frame_seconds(const PlayerContext& ctx, const AVFrame* frame, double fallback) {
+  int64_t ts = frame_pts(frame);
   if (ts == AV_NOPTS_VALUE) {
-    return ctx.current_seconds;
+    return fallback;
   }
   AVRational tb = ctx.format_ctx->streams[ctx.video_stream_index]->time_base;
   return ts * av_q2d(tb);
 }
 
-bool init_ffmpeg(PlayerContext& ctx, const std::string& path) {
+bool parse_decode_threads(std::string_view value, int* out) {
+  if (value == "auto") {
+    *out = 0;
+    return true;
+  }
+  int threads = 0;
+  auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), threads);
+  if (error != std::errc() || end != value.data() + value.size() || threads < 1 ||
+      threads > kMaxDecodeThreads) {
+    return false;
+  }
+  *out = threads;
+  return true;
+}
+
+bool parse_decode_threading(std::string_view value, DecodeThreading* out) {
+  if (value == "auto") {
+    *out = DecodeThreading::kAuto;
+  } else if (value == "frame") {
+    *out = DecodeThreading::kFrame;
+  } else if (value == "slice") {
+    *out = DecodeThreading::kSlice;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+int auto_decode_threads(int width, int height) {
+  int64_t pixels = static_cast<int64_t>(std::max(width, 1)) * std::max(height, 1);
+  int wanted = static_cast<int>(
+      std::min<int64_t>((pixels + kDecodePixelsPerThread - 1) / kDecodePixelsPerThread,
+                        kMaxDecodeThreads));
+  int cores = static_cast<int>(std::thread::hardware_concurrency());
+  return std::clamp(wanted, 1, std::clamp(cores, 1, kMaxDecodeThreads));
+}
+
+int decode_thread_type(DecodeThreading threading) {
+  switch (threading) {
+    case DecodeThreading::kFrame:
+      return FF_THREAD_FRAME;
+    case DecodeThreading::kSlice:
+      return FF_THREAD_SLICE;
+    case DecodeThreading::kAuto:
+      break;
+  }
+  return FF_THREAD_FRAME | FF_THREAD_SLICE;
+}
+
+// What the opened codec actually runs, which depends on its capabilities.
+std::string describe_decode_threads(const AVCodecContext* codec_ctx) {
+  std::ostringstream out;
+  if (codec_ctx->active_thread_type & FF_THREAD_FRAME) {
+    out << codec_ctx->thread_count << " frame threads";
+  } else if (codec_ctx->active_thread_type & FF_THREAD_SLICE) {
+    out << codec_ctx->thread_count << " slice threads";
+  } else {
+    out << "1 thread";
+  }
+  return out.str();
+}
+
+bool init_ffmpeg(PlayerContext& ctx, const std::string& path,
+                 const DecodeThreadConfig& thread_config) {
   if (avformat_open_input(&ctx.format_ctx, path.c_str(), nullptr, nullptr) < 0) {
     std::cerr << "Failed to open file: " << path << "\n";
     return false;
@@ -167,10 +306,17 @@ bool init_ffmpeg(PlayerContext& ctx, const std::string& path) {
     std::cerr << "Failed to copy codec params.\n";
     return false;
   }
+  ctx.codec_ctx->thread_count =
+      thread_config.threads > 0
+          ? thread_config.threads
+          : auto_decode_threads(ctx.codec_ctx->width, ctx.codec_ctx->height);
+  ctx.codec_ctx->thread_type = decode_thread_type(thread_config.threading);
   if (avcodec_open2(ctx.codec_ctx, ctx.codec, nullptr) < 0) {
     std::cerr << "Failed to open codec.\n";
     return false;
   }
+  std::cout << "Decoding " << ctx.codec->name << ' ' << ctx.codec_ctx->width << 'x'
+            << ctx.codec_ctx->height << " with " << describe_decode_threads(ctx.codec_ctx) << '\n';
 
   AVRational fr = stream->avg_frame_rate.num > 0 ? stream->avg_frame_rate : stream->r_frame_rate;
   if (fr.num > 0 && fr.den > 0) {
@@ -183,10 +329,9 @@ bool init_ffmpeg(PlayerContext& ctx, const std::string& path) {
     ctx.duration_seconds = static_cast<double>(ctx.format_ctx->duration) / AV_TIME_BASE;
   }
 
-  ctx.frame = av_frame_alloc();
   ctx.packet = av_packet_alloc();
-  if (!ctx.frame || !ctx.packet) {
-    std::cerr << "Failed to allocate frame/packet.\n";
+  if (!ctx.packet) {
+    std::cerr << "Failed to allocate packet.\n";
     return false;
   }
 
@@ -233,7 +378,6 @@ bool init_ffmpeg(PlayerContext& ctx, const std::string& path) {
 
 void free_ffmpeg(PlayerContext& ctx) {
   if (ctx.packet) av_packet_free(&ctx.packet);
-  if (ctx.frame) av_frame_free(&ctx.frame);
   if (ctx.rgb_frame) av_frame_free(&ctx.rgb_frame);
   if (ctx.sws_ctx) sws_freeContext(ctx.sws_ctx);
   if (ctx.rgb_buffer) av_free(ctx.rgb_buffer);
@@ -241,90 +385,317 @@ void free_ffmpeg(PlayerContext& ctx) {
   if (ctx.format_ctx) avformat_close_input(&ctx.format_ctx);
 }
 
-bool decode_one_frame(PlayerContext& ctx) {
+// Decode thread: decodes the next video frame into `frame`. Returns false at
+// the end of the stream, once the decoder has been drained, or on an error.
+bool decode_frame(PlayerContext& ctx, AVFrame* frame) {
   while (true) {
-    int read_status = av_read_frame(ctx.format_ctx, ctx.packet);
-    if (read_status < 0) {
-      ctx.eof = true;
+    int receive_status = avcodec_receive_frame(ctx.codec_ctx, frame);
+    if (receive_status == 0) {
+      return true;
+    }
+    if (receive_status != AVERROR(EAGAIN)) {
       return false;
     }
-
-    if (ctx.packet->stream_index != ctx.video_stream_index) {
-      av_packet_unref(ctx.packet);
+    if (av_read_frame(ctx.format_ctx, ctx.packet) < 0) {
+      // Flush the frames the decoder still holds back for reordering.
+      avcodec_send_packet(ctx.codec_ctx, nullptr);
       continue;
     }
-
-    if (avcodec_send_packet(ctx.codec_ctx, ctx.packet) < 0) {
-      av_packet_unref(ctx.packet);
-      continue;
+    if (ctx.packet->stream_index == ctx.video_stream_index) {
+      // A packet the decoder rejects is skipped.
+      avcodec_send_packet(ctx.codec_ctx, ctx.packet);
     }
     av_packet_unref(ctx.packet);
+  }
+}
 
-    int receive_status = avcodec_receive_frame(ctx.codec_ctx, ctx.frame);
-    if (receive_status == AVERROR(EAGAIN)) {
-      continue;
-    }
-    if (receive_status < 0) {
+// Decode thread: seeks to the keyframe before `target_seconds` and decodes
+// into `frame` up to the first frame at or after it. Returns false if the
+// stream could not seek; `*decoded` says whether a frame was found.
+bool seek_stream(PlayerContext& ctx, double target_seconds, AVFrame* frame, bool* decoded) {
+  *decoded = false;
+  AVStream* stream = ctx.format_ctx->streams[ctx.video_stream_index];
+  int64_t target_ts = static_cast<int64_t>(target_seconds / av_q2d(stream->time_base));
+
+  int seek_res = avformat_seek_file(ctx.format_ctx, ctx.video_stream_index, INT64_MIN, target_ts,
+                                    INT64_MAX, AVSEEK_FLAG_BACKWARD);
+  if (seek_res < 0) {
+    seek_res = av_seek_frame(ctx.format_ctx, ctx.video_stream_index, target_ts, AVSEEK_FLAG_BACKWARD);
+    if (seek_res < 0) {
       return false;
     }
+  }
+
+  avcodec_flush_buffers(ctx.codec_ctx);
 
-    if (!ctx.use_yuv420_texture) {
-      sws_scale(ctx.sws_ctx, ctx.frame->data, ctx.frame->linesize, 0, ctx.codec_ctx->height,
-                ctx.rgb_frame->data, ctx.rgb_frame->linesize);
+  // Decoding clears its output first, so the last frame before the end of
+  // the stream survives only in a second frame.
+  AVFrame* next = av_frame_alloc();
+  if (!next) {
+    return false;
+  }
+  for (int i = 0; i < kSeekToleranceFrames && decode_frame(ctx, next); ++i) {
+    av_frame_unref(frame);
+    av_frame_move_ref(frame, next);
+    *decoded = true;
+    if (frame_seconds(ctx, frame, target_seconds) >= target_seconds ||
+        ctx.duration_seconds <= 0.0) {
+      break;
     }
+  }
+  av_frame_free(&next);
+  return true;
+}
 
-    ctx.current_pts = (ctx.frame->best_effort_timestamp != AV_NOPTS_VALUE) ? ctx.frame->best_effort_timestamp
-                                                                            : ctx.frame->pts;
-    ctx.current_seconds = frame_seconds(ctx);
-    if (ctx.duration_seconds > 0.0) {
-      ctx.current_seconds = std::clamp(ctx.current_seconds, 0.0, ctx.duration_seconds);
+// Runs demuxing and decoding on its own thread, ahead of presentation. A
+// fixed set of frames circulates: the decode thread takes a free one,
+// decodes into it and queues it; the render thread pops it, shows it and
+// releases it once the next one has replaced it. While every frame is queued
+// or on screen the decode thread waits, so the set bounds both memory and how
+// far decoding runs ahead, and decode time overlaps with presentation.
+class Decoder {
+ public:
+  Decoder(PlayerContext& ctx, size_t queue_frames) : ctx_(ctx) {
+    // One more than the queue holds: the frame on screen.
+    for (size_t i = 0; i <= queue_frames; ++i) {
+      if (AVFrame* frame = av_frame_alloc()) {
+        frames_.push_back(frame);
+        free_.push_back(frame);
+      }
     }
-    ++ctx.decoded_frames;
+  }
 
+  ~Decoder() {
+    Stop();
+    for (AVFrame* frame : frames_) {
+      av_frame_free(&frame);
+    }
+  }
+
+  Decoder(const Decoder&) = delete;
+  Decoder& operator=(const Decoder&) = delete;
+
+  bool Start() {
+    if (frames_.size() < 2) {
+      std::cerr << "Failed to allocate decoder frames.\n";
+      return false;
+    }
+    thread_ = std::thread(&Decoder::Run, this);
     return true;
   }
+
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    changed_.notify_all();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  // The next decoded frame, or nullptr if none is ready. With `wait`, blocks
+  // until one is, unless the stream has ended.
+  AVFrame* Pop(bool wait) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (wait) {
+      changed_.wait(lock, [&] { return !queued_.empty() || eof_ || stopping_; });
+    }
+    if (queued_.empty()) {
+      return nullptr;
+    }
+    AVFrame* frame = queued_.front();
+    queued_.pop_front();
+    return frame;
+  }
+
+  // The frame Pop would return next, left queued. Only the render thread
+  // pops or seeks, so the frame stays valid until it does.
+  AVFrame* Peek() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queued_.empty() ? nullptr : queued_.front();
+  }
+
+  // Hands a popped frame back for reuse.
+  void Release(AVFrame* frame) {
+    av_frame_unref(frame);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      free_.push_back(frame);
+    }
+    changed_.notify_all();
+  }
+
+  // Drops the queued frames and has the decode thread seek; returns once the
+  // frame at `target_seconds` is queued or the seek failed.
+  bool Seek(double target_seconds) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    seek_target_ = target_seconds;
+    uint64_t serial = ++seek_requested_;
+    changed_.notify_all();
+    changed_.wait(lock, [&] { return seek_done_ >= serial || stopping_; });
+    return seek_done_ >= serial && seek_ok_;
+  }
+
+  // True once the stream has ended and every frame has been popped.
+  bool Finished() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return eof_ && queued_.empty();
+  }
+
+ private:
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      changed_.wait(lock, [&] {
+        return stopping_ || seek_done_ != seek_requested_ || (!eof_ && !free_.empty());
+      });
+      if (stopping_) {
+        return;
+      }
+      if (seek_done_ != seek_requested_) {
+        uint64_t serial = seek_requested_;
+        double target_seconds = seek_target_;
+        for (AVFrame* queued : queued_) {
+          av_frame_unref(queued);
+          free_.push_back(queued);
+        }
+        queued_.clear();
+        AVFrame* frame = free_.back();
+        free_.pop_back();
+        lock.unlock();
+        bool decoded = false;
+        bool ok = seek_stream(ctx_, target_seconds, frame, &decoded);
+        lock.lock();
+        if (decoded) {
+          queued_.push_back(frame);
+        } else {
+          av_frame_unref(frame);
+          free_.push_back(frame);
+        }
+        eof_ = ok && !decoded;
+        seek_ok_ = ok;
+        seek_done_ = serial;
+        changed_.notify_all();
+        continue;
+      }
+
+      AVFrame* frame = free_.back();
+      free_.pop_back();
+      lock.unlock();
+      bool decoded = decode_frame(ctx_, frame);
+      lock.lock();
+      if (decoded && seek_done_ == seek_requested_) {
+        queued_.push_back(frame);
+      } else {
+        av_frame_unref(frame);
+        free_.push_back(frame);
+        // A pending seek restarts decoding anyway.
+        eof_ = seek_done_ == seek_requested_;
+      }
+      changed_.notify_all();
+    }
+  }
+
+  PlayerContext& ctx_;
+  std::vector<AVFrame*> frames_;
+  std::thread thread_;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::vector<AVFrame*> free_;
+  std::deque<AVFrame*> queued_;
+  bool eof_ = false;
+  bool stopping_ = false;
+  double seek_target_ = 0.0;
+  uint64_t seek_requested_ = 0;
+  uint64_t seek_done_ = 0;
+  bool seek_ok_ = false;
+};
+
+// Where a frame without a timestamp goes: one frame after the current one.
+double next_frame_seconds(const PlayerContext& ctx) {
+  return ctx.current_seconds + 1.0 / std::max(1.0, ctx.fps);
 }
 
+// Render thread: puts `frame` on screen in place of the current one.
+void show_frame(PlayerContext& ctx, Decoder& decoder, AVFrame* frame) {
+  if (ctx.frame) {
+    decoder.Release(ctx.frame);
+  }
+  ctx.frame = frame;
+  ctx.current_pts = frame_pts(frame);
+  ctx.current_seconds = frame_seconds(ctx, frame, next_frame_seconds(ctx));
+  if (ctx.duration_seconds > 0.0) {
+    ctx.current_seconds = std::clamp(ctx.current_seconds, 0.0, ctx.duration_seconds);
+  }
+  ++ctx.decoded_frames;
+}
+
+// Master clock of the render loop: the media time that should be on screen
+// at a given wall time. It runs at the playback rate from an anchor, which
+// seeks and pauses move; rate changes re-anchor it, so it never jumps.
+class PresentationClock {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  void Reset(double media_seconds, Clock::time_point now) {
+    anchor_media_ = media_seconds;
+    anchor_wall_ = now;
+  }
+
+  void SetRate(double rate, Clock::time_point now) {
+    if (rate != rate_) {
+      Reset(MediaAt(now), now);
+      rate_ = rate;
+    }
+  }
+
+  double MediaAt(Clock::time_point now) const {
+    return anchor_media_ + std::chrono::duration<double>(now - anchor_wall_).count() * rate_;
+  }
+
+  Clock::time_point WallAt(double media_seconds) const {
+    return anchor_wall_ + std::chrono::duration_cast<Clock::duration>(
+                              std::chrono::duration<double>((media_seconds - anchor_media_) /
+                                                            rate_));
+  }
+
+ private:
+  double anchor_media_ = 0.0;
+  Clock::time_point anchor_wall_;
+  double rate_ = 1.0;
+};
+
 bool update_texture_from_frame(const PlayerContext& ctx, SDL_Texture* texture) {
+  if (!ctx.frame) {
+    return false;
+  }
   if (ctx.use_yuv420_texture) {
     return SDL_UpdateYUVTexture(texture, nullptr, ctx.frame->data[0], ctx.frame->linesize[0],
                                 ctx.frame->data[1], ctx.frame->linesize[1], ctx.frame->data[2],
                                 ctx.frame->linesize[2]) == 0;
   }
+  // Converted only here, so frames decoded and dropped cost no conversion.
+  sws_scale(ctx.sws_ctx, ctx.frame->data, ctx.frame->linesize, 0, ctx.frame->height,
+            ctx.rgb_frame->data, ctx.rgb_frame->linesize);
   return SDL_UpdateTexture(texture, nullptr, ctx.rgb_frame->data[0], ctx.rgb_frame->linesize[0]) == 0;
 }
 
-bool seek_to(PlayerContext& ctx, double target_seconds) {
+bool seek_to(PlayerContext& ctx, Decoder& decoder, double target_seconds) {
   if (ctx.duration_seconds > 0.0) {
     target_seconds = std::clamp(target_seconds, 0.0, ctx.duration_seconds);
   } else {
     target_seconds = std::max(0.0, target_seconds);
   }
-
-  AVStream* stream = ctx.format_ctx->streams[ctx.video_stream_index];
-  int64_t target_ts = static_cast<int64_t>(target_seconds / av_q2d(stream->time_base));
-
-  int seek_res = avformat_seek_file(ctx.format_ctx, ctx.video_stream_index, INT64_MIN, target_ts,
-                                    INT64_MAX, AVSEEK_FLAG_BACKWARD);
-  if (seek_res < 0) {
-    seek_res = av_seek_frame(ctx.format_ctx, ctx.video_stream_index, target_ts, AVSEEK_FLAG_BACKWARD);
-    if (seek_res < 0) {
-      return false;
-    }
+  if (!decoder.Seek(target_seconds)) {
+    return false;
   }
-
-  avcodec_flush_buffers(ctx.codec_ctx);
-  ctx.eof = false;
-
-  for (int i = 0; i < kSeekToleranceFrames; ++i) {
-    if (!decode_one_frame(ctx)) {
-      return true;
-    }
-    if (ctx.current_seconds >= target_seconds || ctx.duration_seconds <= 0.0) {
-      return true;
-    }
+  if (AVFrame* frame = decoder.Pop(false)) {
+    show_frame(ctx, decoder, frame);
   }
-
+  ctx.eof = decoder.Finished();
   return true;
 }
 
@@ -433,15 +804,57 @@ int64_t now_epoch_ms() {
   return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
 }
 
+// Where the sender of `snap` is at `now_ms` on the shared clock.
+double remote_playhead_seconds(const SyncStateSnapshot& snap, int64_t now_ms,
+                               double duration_seconds) {
+  double seconds = std::max(0.0, static_cast<double>(snap.playhead_ms) / 1000.0);
+  if (!snap.paused) {
+    seconds += static_cast<double>(std::max<int64_t>(0, now_ms - snap.sent_epoch_ms)) / 1000.0;
+  }
+  if (duration_seconds > 0.0) {
+    seconds = std::clamp(seconds, 0.0, duration_seconds);
+  }
+  return seconds;
+}
+
+// Playback rate that closes `error_seconds` (positive when behind the leader)
+// without a seek, which would flush the decoder and stall the picture.
+double catch_up_rate(double error_seconds) {
+  if (std::abs(error_seconds) <= kSyncDeadbandSeconds) {
+    return 1.0;
+  }
+  return 1.0 + std::clamp(error_seconds * kSyncRateGain, -kSyncMaxRateAdjust, kSyncMaxRateAdjust);
+}
+
+StatusRecord build_status_record(uint32_t file_id, const PlayerContext& ctx, bool paused, int win_w,
+                                 int win_h, PlaybackState state, int64_t sent_epoch_ms,
+                                 double playhead_seconds) {
+  StatusRecord record;
+  record.state = state;
+  record.flags = static_cast<uint8_t>((paused ? kStatusFlagPaused : 0) | (ctx.eof ? kStatusFlagEof : 0));
+  record.file_id = file_id;
+  record.fps_milli = static_cast<uint32_t>(std::max(0.0, ctx.fps) * 1000.0);
+  record.window_w = static_cast<uint16_t>(std::clamp(win_w, 0, 0xFFFF));
+  record.window_h = static_cast<uint16_t>(std::clamp(win_h, 0, 0xFFFF));
+  record.sent_epoch_ms = sent_epoch_ms;
+  record.playhead_ms = static_cast<int64_t>(std::max(0.0, playhead_seconds) * 1000.0);
+  record.sync_anchor_epoch_ms = record.sent_epoch_ms - record.playhead_ms;
+  record.duration_ms = static_cast<int64_t>(std::max(0.0, ctx.duration_seconds) * 1000.0);
+  record.pts = ctx.current_pts;
+  record.frame_index = static_cast<int64_t>(ctx.current_seconds * std::max(1.0, ctx.fps));
+  record.decoded_frames = ctx.decoded_frames;
+  return record;
+}
+
 std::string build_status_payload(const std::string& video_file_name, const PlayerContext& ctx, bool paused,
-                                 int win_w, int win_h, const std::string& state_tag) {
+                                 int win_w, int win_h, PlaybackState state, int64_t sent_ms,
+                                 double playhead_seconds) {
   double progress = 0.0;
   if (ctx.duration_seconds > 0.0) {
-    progress = std::clamp((ctx.current_seconds / ctx.duration_seconds) * 100.0, 0.0, 100.0);
+    progress = std::clamp((playhead_seconds / ctx.duration_seconds) * 100.0, 0.0, 100.0);
   }
-  double remaining = std::max(0.0, ctx.duration_seconds - ctx.current_seconds);
-  int64_t sent_ms = now_epoch_ms();
-  int64_t playhead_ms = static_cast<int64_t>(std::max(0.0, ctx.current_seconds) * 1000.0);
+  double remaining = std::max(0.0, ctx.duration_seconds - playhead_seconds);
+  int64_t playhead_ms = static_cast<int64_t>(std::max(0.0, playhead_seconds) * 1000.0);
   int64_t duration_ms = static_cast<int64_t>(std::max(0.0, ctx.duration_seconds) * 1000.0);
   int64_t remaining_ms = std::max<int64_t>(0, duration_ms - playhead_ms);
   int64_t sync_anchor_epoch_ms = sent_ms - playhead_ms;
@@ -449,13 +862,13 @@ std::string build_status_payload(const std::string& video_file_name, const Playe
 
   std::ostringstream out;
   out << "[VIDEO_STATUS]"
-      << " file_name=" << video_file_name << " elapsed=" << format_seconds(ctx.current_seconds)
+      << " file_name=" << video_file_name << " elapsed=" << format_seconds(playhead_seconds)
       << " remaining=" << format_seconds(remaining)
       << " total=" << format_seconds(std::max(0.0, ctx.duration_seconds)) << " progress=" << std::fixed
       << std::setprecision(2) << progress << "%"
       << " fps=" << std::setprecision(2) << ctx.fps << " paused=" << (paused ? "yes" : "no")
       << " eof=" << (ctx.eof ? "yes" : "no") << " window=" << win_w << "x" << win_h
-      << " state=" << state_tag << " sent_epoch_ms=" << sent_ms << " sync_anchor_epoch_ms="
+      << " state=" << playback_state_name(state) << " sent_epoch_ms=" << sent_ms << " sync_anchor_epoch_ms="
       << sync_anchor_epoch_ms << " playhead_ms=" << playhead_ms << " duration_ms=" << duration_ms
       << " remaining_ms=" << remaining_ms << " frame_index=" << frame_index
       << " decoded_frames=" << ctx.decoded_frames << " pts=" << ctx.current_pts;
@@ -465,20 +878,74 @@ std::string build_status_payload(const std::string& video_file_name, const Playe
 
 int main(int argc, char* argv[]) {
   if (argc < 2) {
-    std::cerr << "Usage: " << argv[0] << " <video_path> [sync_server_ip] [sync_server_port]\n";
+    std::cerr << "Usage: " << argv[0]
+              << " <video_path> [sync_server_ip] [sync_server_port] [--status-format binary|text]"
+                 " [--name NAME] [--role leader|follower|monitor] [--decode-threads N|auto]"
+                 " [--decode-threading auto|frame|slice]\n";
+    return 1;
+  }
+
+  std::vector<std::string> positional;
+  StatusFormat status_format = StatusFormat::kBinary;
+  std::string client_name;
+  ClientRole client_role = ClientRole::kFollower;
+  DecodeThreadConfig decode_threads;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--status-format" && i + 1 < argc) {
+      std::string value = argv[++i];
+      if (value == "binary") {
+        status_format = StatusFormat::kBinary;
+      } else if (value == "text") {
+        status_format = StatusFormat::kText;
+      } else {
+        std::cerr << "Unknown status format: " << value << '\n';
+        return 1;
+      }
+    } else if (arg == "--name" && i + 1 < argc) {
+      client_name = argv[++i];
+      if (!valid_client_name(client_name)) {
+        std::cerr << "Invalid client name: " << client_name << '\n';
+        return 1;
+      }
+    } else if (arg == "--role" && i + 1 < argc) {
+      std::string value = argv[++i];
+      if (!parse_client_role(value, &client_role)) {
+        std::cerr << "Unknown role: " << value << '\n';
+        return 1;
+      }
+    } else if (arg == "--decode-threads" && i + 1 < argc) {
+      std::string value = argv[++i];
+      if (!parse_decode_threads(value, &decode_threads.threads)) {
+        std::cerr << "Invalid decode thread count: " << value << '\n';
+        return 1;
+      }
+    } else if (arg == "--decode-threading" && i + 1 < argc) {
+      std::string value = argv[++i];
+      if (!parse_decode_threading(value, &decode_threads.threading)) {
+        std::cerr << "Unknown decode threading: " << value << '\n';
+        return 1;
+      }
+    } else {
+      positional.push_back(arg);
+    }
+  }
+  if (positional.empty()) {
+    std::cerr << "Missing video path.\n";
     return 1;
   }
 
-  const std::string video_path = argv[1];
+  const std::string video_path = positional[0];
   const std::string video_file_name = basename_of(video_path);
-  const std::string sync_server_ip = (argc > 2) ? argv[2] : "127.0.0.1";
+  const uint32_t video_file_id = hash_name(video_file_name);
+  const std::string sync_server_ip = (positional.size() > 1) ? positional[1] : "127.0.0.1";
   int sync_server_port = 54000;
-  if (argc > 3) {
-    sync_server_port = std::stoi(argv[3]);
+  if (positional.size() > 2) {
+    sync_server_port = std::stoi(positional[2]);
   }
 
   PlayerContext ctx;
-  if (!init_ffmpeg(ctx, video_path)) {
+  if (!init_ffmpeg(ctx, video_path, decode_threads)) {
     free_ffmpeg(ctx);
     return 1;
   }
@@ -527,60 +994,111 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
+  Decoder decoder(ctx, kDecodeQueueFrames);
+  if (!decoder.Start()) {
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    free_ffmpeg(ctx);
+    return 1;
+  }
+
   bool running = true;
   bool paused = false;
   bool dragging_seek = false;
   double dragging_seek_ratio = 0.0;
   bool send_status_now = true;
-  std::string status_state = "playing";
+  PlaybackState status_state = PlaybackState::kPlaying;
   Uint32 last_status_sent_ms = 0;
   Uint32 last_seek_action_ms = 0;
   Uint32 last_remote_seek_applied_ms = 0;
-  Uint32 frame_delay_ms = static_cast<Uint32>(1000.0 / std::max(1.0, ctx.fps));
   std::mutex pending_sync_mutex;
   std::optional<PendingRemoteSync> pending_sync;
   int64_t last_applied_remote_sent_epoch_ms = 0;
-  std::string receiver_buffer;
+  // Latest status of a playing peer, which this player keeps pace with.
+  std::optional<SyncStateSnapshot> sync_reference;
+  int clock_probes = 0;
+  Uint32 last_clock_probe_ms = 0;
   ChatClient status_client;
+  status_client.SetWireFormat(WireFormat::kBinary);
+  status_client.SetPublishChannel(video_file_name);
+  if (!client_name.empty()) {
+    status_client.SetIdentity(client_name, client_role);
+  }
+  // ChatClient reconnects on its own and restores the subscriptions below.
+  // Stale status records would make peers seek backwards, so none are kept
+  // during an outage; a fresh one goes out as soon as the link is back.
+  status_client.SetOutageBuffer(0);
   bool status_connected = status_client.Connect(sync_server_ip, sync_server_port);
   if (!status_connected) {
     std::cerr << "Warning: failed to connect status stream to " << sync_server_ip << ":"
-              << sync_server_port << "\n";
-  } else {
-    status_client.StartReceiver([&](const std::string& chunk) {
-      receiver_buffer.append(chunk);
-      if (receiver_buffer.size() > 1024 * 1024) {
-        receiver_buffer.clear();
-      }
+              << sync_server_port << ", retrying in the background\n";
+  }
+  status_client.Subscribe(video_file_name);
+  status_client.Unsubscribe(std::string(kLobbyChannelName));
+  status_client.StartFrameReceiver([&](const FrameView& frame) {
+    auto parsed = parse_sync_frame(frame);
+    if (!parsed) {
+      return;
+    }
+    if (parsed->file_id != video_file_id) {
+      return;
+    }
+    if (parsed->sent_epoch_ms <= 0) {
+      return;
+    }
 
-      size_t line_end = 0;
-      while ((line_end = receiver_buffer.find('\n')) != std::string::npos) {
-        std::string line = receiver_buffer.substr(0, line_end);
-        receiver_buffer.erase(0, line_end + 1);
+    PendingRemoteSync next;
+    next.snapshot = *parsed;
+    std::lock_guard<std::mutex> lock(pending_sync_mutex);
+    pending_sync = next;
+  });
 
-        auto parsed = parse_sync_line(line);
-        if (!parsed) {
-          continue;
-        }
-        if (parsed->file_name != video_file_name) {
-          continue;
-        }
-        if (parsed->sent_epoch_ms <= 0) {
-          continue;
-        }
-
-        PendingRemoteSync next;
-        next.snapshot = *parsed;
-        std::lock_guard<std::mutex> lock(pending_sync_mutex);
-        pending_sync = next;
-      }
-    });
+  if (AVFrame* first = decoder.Pop(true)) {
+    show_frame(ctx, decoder, first);
   }
-
-  decode_one_frame(ctx);
   if (!update_texture_from_frame(ctx, texture)) {
     std::cerr << "Failed to upload initial frame to texture: " << SDL_GetError() << "\n";
   }
+  PresentationClock clock;
+  clock.Reset(ctx.current_seconds, PresentationClock::Clock::now());
+  // How long after its due time each frame reached the screen.
+  LatencyHistogram lateness;
+  uint64_t frames_dropped = 0;
+  bool redraw = true;
+  // The clock while playing, the frame on screen otherwise.
+  auto playhead_seconds = [&] {
+    if (paused || ctx.eof) {
+      return ctx.current_seconds;
+    }
+    return clock.MediaAt(PresentationClock::Clock::now());
+  };
+
+  // Status times are stamped and compared on the server's clock, so neither
+  // skew between the players' clocks nor network delay reads as drift. Until
+  // the first probe returns, the local clock stands in.
+  auto shared_now_ms = [&] {
+    int64_t server_ns = 0;
+    if (status_client.ServerTimeNs(&server_ns)) {
+      return server_ns / 1000000;
+    }
+    return now_epoch_ms();
+  };
+
+  auto send_status = [&](PlaybackState state) {
+    if (status_format == StatusFormat::kText) {
+      return status_client.PostLine(build_status_payload(
+          video_file_name, ctx, paused, win_w, win_h, state, shared_now_ms(), playhead_seconds()));
+    }
+    uint8_t record_bytes[kStatusRecordSize];
+    encode_status_record(build_status_record(video_file_id, ctx, paused, win_w, win_h, state,
+                                             shared_now_ms(), playhead_seconds()),
+                         record_bytes);
+    return status_client.PostFrame(
+        FrameType::kStatus, status_client.PublishChannelId(),
+        std::string_view(reinterpret_cast<const char*>(record_bytes), sizeof(record_bytes)));
+  };
 
   auto perform_seek_action = [&](double target_seconds, bool force) {
     Uint32 now_ms = SDL_GetTicks();
@@ -593,9 +1111,15 @@ int main(int argc, char* argv[]) {
         return false;
       }
     }
-    if (seek_to(ctx, target_seconds)) {
+    if (seek_to(ctx, decoder, target_seconds)) {
       last_seek_action_ms = now_ms;
-      status_state = "seeking";
+      // Playback resumes from the target frame, however long the seek took.
+      clock.Reset(ctx.current_seconds, PresentationClock::Clock::now());
+      if (!update_texture_from_frame(ctx, texture)) {
+        std::cerr << "Failed to upload seek frame to texture: " << SDL_GetError() << "\n";
+      }
+      redraw = true;
+      status_state = PlaybackState::kSeeking;
       send_status_now = true;
       return true;
     }
@@ -608,12 +1132,13 @@ int main(int argc, char* argv[]) {
 
     SDL_Event event;
     while (SDL_PollEvent(&event)) {
+      redraw = true;
       if (event.type == SDL_QUIT) {
         running = false;
       } else if (event.type == SDL_KEYDOWN) {
         if (event.key.keysym.sym == SDLK_SPACE) {
           paused = !paused;
-          status_state = paused ? "paused" : "playing";
+          status_state = paused ? PlaybackState::kPaused : PlaybackState::kPlaying;
           send_status_now = true;
         }
         if (event.key.keysym.sym == SDLK_LEFT) {
@@ -670,18 +1195,10 @@ int main(int argc, char* argv[]) {
       if (remote_update.has_value()) {
         const SyncStateSnapshot& snap = remote_update->snapshot;
         if (snap.sent_epoch_ms > last_applied_remote_sent_epoch_ms) {
-          double target_seconds = std::max(0.0, static_cast<double>(snap.playhead_ms) / 1000.0);
-          if (!snap.paused) {
-            int64_t now_ms = now_epoch_ms();
-            int64_t drift_ms = std::max<int64_t>(0, now_ms - snap.sent_epoch_ms);
-            target_seconds += static_cast<double>(drift_ms) / 1000.0;
-          }
-          if (ctx.duration_seconds > 0.0) {
-            target_seconds = std::clamp(target_seconds, 0.0, ctx.duration_seconds);
-          }
-
-          bool should_seek = (snap.state == "seeking");
-          double drift = std::abs(ctx.current_seconds - target_seconds);
+          double target_seconds =
+              remote_playhead_seconds(snap, shared_now_ms(), ctx.duration_seconds);
+          bool should_seek = (snap.state == PlaybackState::kSeeking);
+          double drift = std::abs(playhead_seconds() - target_seconds);
           Uint32 now_ms = SDL_GetTicks();
           if (should_seek && drift < kSeekActionMinDeltaSeconds) {
             should_seek = false;
@@ -689,76 +1206,151 @@ int main(int argc, char* argv[]) {
           if (should_seek && now_ms - last_remote_seek_applied_ms < kRemoteSeekApplyIntervalMs) {
             should_seek = false;
           }
-          if (!should_seek && drift >= kSyncDriftThresholdSeconds) {
+          // Smaller drift during playback is left to catch_up_rate; paused,
+          // there is no playback to absorb it.
+          double seek_threshold =
+              snap.paused ? kSeekActionMinDeltaSeconds : kSyncSeekThresholdSeconds;
+          if (!should_seek && drift >= seek_threshold) {
             should_seek = true;
           }
 
           bool pause_changed = (paused != snap.paused);
-          if (should_seek && seek_to(ctx, target_seconds)) {
+          if (should_seek && seek_to(ctx, decoder, target_seconds)) {
             last_remote_seek_applied_ms = now_ms;
+            clock.Reset(ctx.current_seconds, PresentationClock::Clock::now());
             if (!update_texture_from_frame(ctx, texture)) {
               std::cerr << "Failed to upload synced frame to texture: " << SDL_GetError() << "\n";
             }
+            redraw = true;
           }
           if (pause_changed) {
             paused = snap.paused;
           }
 
           if (should_seek || pause_changed) {
-            status_state = snap.paused ? "paused" : "playing";
+            status_state = snap.paused ? PlaybackState::kPaused : PlaybackState::kPlaying;
           }
           last_applied_remote_sent_epoch_ms = snap.sent_epoch_ms;
+          sync_reference.reset();
+          if (!snap.paused && (snap.state == PlaybackState::kPlaying ||
+                               snap.state == PlaybackState::kSeeking)) {
+            sync_reference = snap;
+          }
         }
       }
     }
 
-    if (!paused && !ctx.eof) {
-      if (decode_one_frame(ctx)) {
+    auto now = PresentationClock::Clock::now();
+    double playback_rate = 1.0;
+    if (sync_reference.has_value() && !paused) {
+      int64_t now_ms = shared_now_ms();
+      if (now_ms - sync_reference->sent_epoch_ms > kSyncReferenceMaxAgeMs) {
+        sync_reference.reset();
+      } else {
+        double target_seconds =
+            remote_playhead_seconds(*sync_reference, now_ms, ctx.duration_seconds);
+        playback_rate = catch_up_rate(target_seconds - playhead_seconds());
+      }
+    }
+
+    // Each frame goes on screen when the clock reaches its timestamp. Frames
+    // whose successor is already due are dropped unseen; until the next one
+    // is due, the loop sleeps.
+    bool shown = false;
+    PresentationClock::Clock::time_point next_due = now + kMaxFrameWait;
+    if (paused || ctx.eof) {
+      clock.Reset(ctx.current_seconds, now);
+    } else {
+      clock.SetRate(playback_rate, now);
+      while (AVFrame* next = decoder.Peek()) {
+        double next_seconds = frame_seconds(ctx, next, next_frame_seconds(ctx));
+        if (std::abs(next_seconds - ctx.current_seconds) > kMaxFrameGapSeconds) {
+          clock.Reset(next_seconds, now);
+        }
+        if (next_seconds > clock.MediaAt(now)) {
+          next_due = std::min(next_due, clock.WallAt(next_seconds));
+          break;
+        }
+        frames_dropped += shown ? 1 : 0;
+        show_frame(ctx, decoder, decoder.Pop(false));
+        shown = true;
+      }
+      if (!decoder.Peek()) {
+        if (decoder.Finished()) {
+          ctx.eof = !shown;
+        } else {
+          // Decoding is behind; look again soon rather than a whole wait later.
+          next_due = std::min(next_due, now + kDecoderPollWait);
+        }
+      }
+      if (shown) {
         if (!update_texture_from_frame(ctx, texture)) {
           std::cerr << "Failed to upload frame to texture: " << SDL_GetError() << "\n";
         }
-        if (status_state != "seeking") {
-          status_state = "playing";
+        if (status_state != PlaybackState::kSeeking) {
+          status_state = PlaybackState::kPlaying;
         }
+        redraw = true;
       }
     }
     if (ctx.eof) {
-      status_state = "eof";
+      status_state = PlaybackState::kEof;
     }
 
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderClear(renderer);
-    SDL_RenderCopy(renderer, texture, nullptr, &layout.video_dst);
-    double progress = ctx.duration_seconds > 0.0 ? (ctx.current_seconds / ctx.duration_seconds) : 0.0;
-    if (dragging_seek && ctx.duration_seconds > 0.0) {
-      progress = dragging_seek_ratio;
+    if (redraw || dragging_seek) {
+      SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+      SDL_RenderClear(renderer);
+      SDL_RenderCopy(renderer, texture, nullptr, &layout.video_dst);
+      double progress =
+          ctx.duration_seconds > 0.0 ? (ctx.current_seconds / ctx.duration_seconds) : 0.0;
+      if (dragging_seek && ctx.duration_seconds > 0.0) {
+        progress = dragging_seek_ratio;
+      }
+      render_ui(renderer, layout, progress);
+      SDL_RenderPresent(renderer);
+      redraw = false;
+    }
+    if (shown) {
+      lateness.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          PresentationClock::Clock::now() - clock.WallAt(ctx.current_seconds))
+                          .count());
     }
-    render_ui(renderer, layout, progress);
-    SDL_RenderPresent(renderer);
 
     Uint32 now_ms = SDL_GetTicks();
-    if (status_connected &&
-        (send_status_now || now_ms - last_status_sent_ms >= kStatusSendIntervalMs)) {
-      std::string payload =
-          build_status_payload(video_file_name, ctx, paused, win_w, win_h, status_state);
-      if (!status_client.SendLine(payload)) {
-        status_connected = false;
-        std::cerr << "Warning: status stream disconnected from media-stream server\n";
+    if (status_client.IsConnected() != status_connected) {
+      status_connected = !status_connected;
+      send_status_now = send_status_now || status_connected;
+      clock_probes = 0;
+    }
+    Uint32 probe_interval_ms =
+        clock_probes < kClockProbeBurst ? kClockProbeBurstIntervalMs : kClockProbeIntervalMs;
+    if (status_connected && now_ms - last_clock_probe_ms >= probe_interval_ms) {
+      if (status_client.SyncClock()) {
+        ++clock_probes;
       }
+      last_clock_probe_ms = now_ms;
+    }
+    if (send_status_now || now_ms - last_status_sent_ms >= kStatusSendIntervalMs) {
+      send_status(status_state);
       last_status_sent_ms = now_ms;
       send_status_now = false;
-      if (status_state == "seeking") {
-        status_state = paused ? "paused" : "playing";
+      if (status_state == PlaybackState::kSeeking) {
+        status_state = paused ? PlaybackState::kPaused : PlaybackState::kPlaying;
       }
     }
 
-    SDL_Delay(frame_delay_ms);
+    std::this_thread::sleep_until(next_due);
   }
 
+  std::cout << "Presented " << lateness.Count() << " frames, dropped " << frames_dropped
+            << " late; lateness p50 < " << lateness.PercentileMicros(0.5) << " us, p99 < "
+            << lateness.PercentileMicros(0.99) << " us\n";
+
   if (status_connected) {
-    status_client.SendLine(build_status_payload(video_file_name, ctx, paused, win_w, win_h, "closed"));
+    send_status(PlaybackState::kClosed);
   }
   status_client.Disconnect();
+  decoder.Stop();
 
   SDL_DestroyTexture(texture);
   SDL_DestroyRenderer(renderer);